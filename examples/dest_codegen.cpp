@@ -0,0 +1,69 @@
+/**
+    This file is part of Deformable Shape Tracking (DEST).
+
+    Copyright(C) 2015/2016 Christoph Heindl
+    All rights reserved.
+
+    This software may be modified and distributed under the terms
+    of the BSD license.See the LICENSE file for details.
+*/
+
+#include <dest/dest.h>
+#include <dest/io/codegen.h>
+#include <tclap/CmdLine.h>
+#include <fstream>
+#include <iostream>
+
+/**
+    Generate C++ source from a trained tracker.
+
+    The generated source contains a single prediction function specialized for the
+    given tracker. Compile it along with your application and link against DEST.
+*/
+int main(int argc, char **argv)
+{
+    struct {
+        std::string tracker;
+        std::string output;
+        dest::io::CodegenParameters codegenParams;
+    } opts;
+
+    try {
+        TCLAP::CmdLine cmd("Generate C++ source from a trained tracker.", ' ', "0.9");
+        TCLAP::ValueArg<std::string> trackerArg("t", "tracker", "Trained tracker to load", true, "dest.bin", "file", cmd);
+        TCLAP::ValueArg<std::string> outputArg("o", "output", "Generated source file", false, "dest_generated.cpp", "file", cmd);
+        TCLAP::ValueArg<std::string> namespaceArg("", "namespace", "Namespace of generated code", false, "dest_generated", "string", cmd);
+        TCLAP::ValueArg<std::string> functionArg("", "function", "Name of generated prediction function", false, "predict", "string", cmd);
+
+        cmd.parse(argc, argv);
+
+        opts.tracker = trackerArg.getValue();
+        opts.output = outputArg.getValue();
+        opts.codegenParams.namespaceName = namespaceArg.getValue();
+        opts.codegenParams.functionName = functionArg.getValue();
+    }
+    catch (TCLAP::ArgException &e) {
+        std::cerr << "Error: " << e.error() << " for arg " << e.argId() << std::endl;
+        return -1;
+    }
+
+    dest::core::Tracker t;
+    if (!t.load(opts.tracker)) {
+        std::cerr << "Failed to load tracker." << std::endl;
+        return -1;
+    }
+
+    std::ofstream ofs(opts.output);
+    if (!ofs.is_open()) {
+        std::cerr << "Failed to open output file." << std::endl;
+        return -1;
+    }
+
+    if (!dest::io::generateTrackerSource(t, ofs, opts.codegenParams)) {
+        std::cerr << "Failed to generate source." << std::endl;
+        return -1;
+    }
+
+    std::cout << "Generated " << opts.codegenParams.namespaceName << "::" << opts.codegenParams.functionName << " in " << opts.output << std::endl;
+    return 0;
+}
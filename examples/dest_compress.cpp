@@ -0,0 +1,96 @@
+/**
+    This file is part of Deformable Shape Tracking (DEST).
+
+    Copyright(C) 2015/2016 Christoph Heindl
+    All rights reserved.
+
+    This software may be modified and distributed under the terms
+    of the BSD license.See the LICENSE file for details.
+*/
+
+#include <dest/dest.h>
+#include <tclap/CmdLine.h>
+#include <opencv2/opencv.hpp>
+
+/**
+    Compress a trained tracker through vector quantization of leaf residuals.
+
+    Accuracy of the original and the compressed tracker is evaluated on the given
+    test database so that the loss due to compression can be judged.
+*/
+int main(int argc, char **argv)
+{
+    struct {
+        std::string tracker;
+        std::string output;
+        std::string database;
+        std::string rectangles;
+        int codebookSize;
+        int randomSeed;
+        dest::io::ImportParameters importParams;
+    } opts;
+
+    try {
+        TCLAP::CmdLine cmd("Compress tracker leaves and evaluate on test database.", ' ', "0.9");
+        TCLAP::ValueArg<std::string> trackerArg("t", "tracker", "Trained tracker to load", true, "dest.bin", "file", cmd);
+        TCLAP::ValueArg<std::string> outputArg("o", "output", "Compressed tracker output", false, "dest_compressed.bin", "file", cmd);
+        TCLAP::ValueArg<std::string> rectanglesArg("r", "rectangles", "Initial rectangles to provide to tracker", false, "rectangles.csv", "file", cmd);
+        TCLAP::ValueArg<int> codebookSizeArg("", "codebook-size", "Maximum number of codebook entries per cascade", false, 256, "int", cmd);
+        TCLAP::ValueArg<int> randomSeedArg("", "rnd-seed", "Seed for the random number generator", false, 10, "int", cmd);
+        TCLAP::ValueArg<int> maxImageSizeArg("", "load-max-size", "Maximum size of images in the database", false, 2048, "int", cmd);
+        TCLAP::UnlabeledValueArg<std::string> databaseArg("database", "Path to database directory to load", true, "./db", "string", cmd);
+
+        cmd.parse(argc, argv);
+
+        opts.tracker = trackerArg.getValue();
+        opts.output = outputArg.getValue();
+        opts.rectangles = rectanglesArg.isSet() ? rectanglesArg.getValue() : "";
+        opts.codebookSize = codebookSizeArg.getValue();
+        opts.randomSeed = randomSeedArg.getValue();
+        opts.database = databaseArg.getValue();
+        opts.importParams.maxImageSideLength = maxImageSizeArg.getValue();
+    }
+    catch (TCLAP::ArgException &e) {
+        std::cout << "Error: " << e.error() << " for arg " << e.argId() << std::endl;
+        return -1;
+    }
+
+    dest::core::Tracker t;
+    if (!t.load(opts.tracker)) {
+        std::cerr << "Failed to load tracker." << std::endl;
+        return -1;
+    }
+
+    dest::core::InputData inputs;
+    dest::io::DatabaseType dbt = dest::io::importDatabase(opts.database, opts.rectangles, inputs.images, inputs.shapes, inputs.rects, opts.importParams, 0, &inputs.imageIds, &inputs.mirrored);
+    if (dbt == dest::io::DATABASE_ERROR) {
+        std::cerr << "Failed to load database." << std::endl;
+        return -1;
+    }
+
+    dest::core::InputData::normalizeShapes(inputs);
+    dest::core::SampleData td(inputs);
+    dest::core::SampleData::createTestingSamples(td);
+
+    dest::core::LandmarkDistanceNormalizer ldn = dest::core::LandmarkDistanceNormalizer::createInterocularNormalizerIBug();
+
+    dest::core::TestResult before = dest::core::testTracker(td, t, ldn);
+
+    std::mt19937 rnd(static_cast<unsigned int>(opts.randomSeed));
+    t.quantizeLeaves(opts.codebookSize, rnd);
+
+    dest::core::TestResult after = dest::core::testTracker(td, t, ldn);
+
+    std::cout << std::setw(40) << std::left << "Average normalized error (original):" << before.meanNormalizedDistance << std::endl;
+    std::cout << std::setw(40) << std::left << "Average normalized error (compressed):" << after.meanNormalizedDistance << std::endl;
+    std::cout << std::setw(40) << std::left << "Median normalized error (original):" << before.medianNormalizedDistance << std::endl;
+    std::cout << std::setw(40) << std::left << "Median normalized error (compressed):" << after.medianNormalizedDistance << std::endl;
+
+    std::cout << "Saving compressed tracker to " << opts.output << std::endl;
+    if (!t.save(opts.output)) {
+        std::cerr << "Failed to save tracker." << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -55,7 +55,7 @@ int main(int argc, char **argv)
     }
     
     dest::core::InputData inputs;
-    dest::io::DatabaseType dbt = dest::io::importDatabase(opts.database, opts.rectangles, inputs.images, inputs.shapes, inputs.rects, opts.importParams);
+    dest::io::DatabaseType dbt = dest::io::importDatabase(opts.database, opts.rectangles, inputs.images, inputs.shapes, inputs.rects, opts.importParams, 0, &inputs.imageIds, &inputs.mirrored);
     if (dbt == dest::io::DATABASE_ERROR) {
         std::cerr << "Failed to load database." << std::endl;
         return -1;
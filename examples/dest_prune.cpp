@@ -0,0 +1,105 @@
+/**
+    This file is part of Deformable Shape Tracking (DEST).
+
+    Copyright(C) 2015/2016 Christoph Heindl
+    All rights reserved.
+
+    This software may be modified and distributed under the terms
+    of the BSD license.See the LICENSE file for details.
+*/
+
+#include <dest/dest.h>
+#include <tclap/CmdLine.h>
+#include <opencv2/opencv.hpp>
+
+/**
+    Remove trees with negligible contribution from a trained tracker. Afterwards pixel
+    coordinates no longer read by any tree are removed as well.
+
+    The contribution of trees is measured on the given validation database, which should
+    not overlap with the training database.
+*/
+int main(int argc, char **argv)
+{
+    struct {
+        std::string tracker;
+        std::string output;
+        std::string database;
+        std::string rectangles;
+        dest::core::PruneParameters pruneParams;
+        dest::io::ImportParameters importParams;
+    } opts;
+
+    try {
+        TCLAP::CmdLine cmd("Prune trees of tracker based on a validation database.", ' ', "0.9");
+        TCLAP::ValueArg<std::string> trackerArg("t", "tracker", "Trained tracker to load", true, "dest.bin", "file", cmd);
+        TCLAP::ValueArg<std::string> outputArg("o", "output", "Pruned tracker output", false, "dest_pruned.bin", "file", cmd);
+        TCLAP::ValueArg<std::string> rectanglesArg("r", "rectangles", "Initial rectangles to provide to tracker", false, "rectangles.csv", "file", cmd);
+        TCLAP::ValueArg<float> maxErrorIncreaseArg("", "max-error-increase", "Maximum tolerated increase of mean normalized error", false, 0.001f, "float", cmd);
+        TCLAP::ValueArg<int> groupSizeArg("", "group-size", "Number of consecutive trees removed together", false, 10, "int", cmd);
+        TCLAP::SwitchArg trailingOnlyArg("", "trailing-only", "Only remove trailing trees of each cascade", cmd, false);
+        TCLAP::ValueArg<int> maxImageSizeArg("", "load-max-size", "Maximum size of images in the database", false, 2048, "int", cmd);
+        TCLAP::UnlabeledValueArg<std::string> databaseArg("database", "Path to validation database directory to load", true, "./db", "string", cmd);
+
+        cmd.parse(argc, argv);
+
+        opts.tracker = trackerArg.getValue();
+        opts.output = outputArg.getValue();
+        opts.rectangles = rectanglesArg.isSet() ? rectanglesArg.getValue() : "";
+        opts.pruneParams.maxErrorIncrease = maxErrorIncreaseArg.getValue();
+        opts.pruneParams.groupSize = groupSizeArg.getValue();
+        opts.pruneParams.trailingOnly = trailingOnlyArg.getValue();
+        opts.database = databaseArg.getValue();
+        opts.importParams.maxImageSideLength = maxImageSizeArg.getValue();
+    }
+    catch (TCLAP::ArgException &e) {
+        std::cout << "Error: " << e.error() << " for arg " << e.argId() << std::endl;
+        return -1;
+    }
+
+    dest::core::Tracker t;
+    if (!t.load(opts.tracker)) {
+        std::cerr << "Failed to load tracker." << std::endl;
+        return -1;
+    }
+
+    dest::core::InputData inputs;
+    dest::io::DatabaseType dbt = dest::io::importDatabase(opts.database, opts.rectangles, inputs.images, inputs.shapes, inputs.rects, opts.importParams, 0, &inputs.imageIds, &inputs.mirrored);
+    if (dbt == dest::io::DATABASE_ERROR) {
+        std::cerr << "Failed to load database." << std::endl;
+        return -1;
+    }
+
+    dest::core::InputData::normalizeShapes(inputs);
+    dest::core::SampleData td(inputs);
+    dest::core::SampleData::createTestingSamples(td);
+
+    dest::core::LandmarkDistanceNormalizer ldn = dest::core::LandmarkDistanceNormalizer::createInterocularNormalizerIBug();
+
+    dest::core::PruneResult r = dest::core::pruneTracker(td, t, ldn, opts.pruneParams);
+    const int numRemovedPixels = t.removeUnusedPixels();
+
+    std::cout << std::setw(40) << std::left << "Number of trees (original):" << r.numTreesBefore << std::endl;
+    std::cout << std::setw(40) << std::left << "Number of trees (pruned):" << r.numTreesAfter << std::endl;
+    for (int c = 0; c < t.numCascades(); ++c) {
+        std::cout << std::setw(40) << std::left << ("Trees in cascade " + std::to_string(c) + ":") << t.numTrees(c) << std::endl;
+    }
+    std::cout << std::setw(40) << std::left << "Unused pixels removed:" << numRemovedPixels << std::endl;
+    for (int c = 0; c < t.numCascades(); ++c) {
+        const Eigen::VectorXi usage = t.pixelUsage(c);
+        std::cout << std::setw(40) << std::left << ("Pixels in cascade " + std::to_string(c) + ":") << usage.size()
+                  << " (max. " << (usage.size() > 0 ? usage.maxCoeff() : 0) << " splits per pixel)" << std::endl;
+    }
+    std::cout << std::setw(40) << std::left << "Average normalized error (original):" << r.before.meanNormalizedDistance << std::endl;
+    std::cout << std::setw(40) << std::left << "Average normalized error (pruned):" << r.after.meanNormalizedDistance << std::endl;
+    std::cout << std::setw(40) << std::left << "Median normalized error (original):" << r.before.medianNormalizedDistance << std::endl;
+    std::cout << std::setw(40) << std::left << "Median normalized error (pruned):" << r.after.medianNormalizedDistance << std::endl;
+
+    std::cout << "Saving pruned tracker to " << opts.output << std::endl;
+    if (!t.save(opts.output)) {
+        std::cerr << "Failed to save tracker." << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -43,6 +43,11 @@ int main(int argc, char **argv)
         TCLAP::ValueArg<int> randomSeedArg("", "train-rnd-seed", "Seed for the random number generator", false, 10, "int", cmd);
         TCLAP::ValueArg<float> lambdaArg("", "train-lambda", "Prior that favors closer pixel coordinates.", false, 0.1f, "float", cmd);
         TCLAP::ValueArg<float> learnArg("", "train-learn", "Learning rate of each tree.", false, 0.08f, "float", cmd);
+        TCLAP::ValueArg<float> sampleFractionArg("", "train-sample-fraction", "Fraction of samples each tree is fit on.", false, 1.f, "float", cmd);
+        TCLAP::ValueArg<float> pixelFractionArg("", "train-pixel-fraction", "Fraction of pixel coordinates each tree may split on.", false, 1.f, "float", cmd);
+        TCLAP::ValueArg<int> numBinsArg("", "train-histogram-bins", "Number of histogram bins for split threshold search. 0 tests a single random threshold per split.", false, 0, "int", cmd);
+        TCLAP::ValueArg<int> numBasisArg("", "train-residual-basis", "Number of PCA basis vectors for leaf residuals per cascade. 0 stores full residuals.", false, 0, "int", cmd);
+        TCLAP::ValueArg<std::string> storeDirArg("", "train-store-dir", "Directory for memory mapped sample data. Keeps sample data in memory when not set.", false, "", "string", cmd);
         
         TCLAP::ValueArg<int> numShapesPerImageArg("", "create-num-shapes", "Number of shapes per image to create.", false, 20, "int", cmd);
         
@@ -51,6 +56,8 @@ int main(int argc, char **argv)
         TCLAP::ValueArg<std::string> outputArg("o", "output", "Trained regressor output.", false, "dest.bin", "string", cmd);
         TCLAP::ValueArg<int> maxImageSizeArg("", "load-max-size", "Maximum size of images in the database", false, 2048, "int", cmd);
         TCLAP::SwitchArg mirrorImageArg("", "load-mirrored", "Additionally mirror each database image, shape and rects.", cmd, false);
+        TCLAP::ValueArg<float> cropMarginArg("", "load-crop-margin", "Crop images to face rectangles enlarged by this fraction on each side. Negative values disable cropping.", false, -1.f, "float", cmd);
+        TCLAP::ValueArg<int> cropSizeArg("", "load-crop-size", "Rescale crops to this face rectangle size in pixels. 0 keeps the size.", false, 0, "int", cmd);
         TCLAP::UnlabeledValueArg<std::string> databaseArg("database", "Path to database directory to load", true, "./db", "string", cmd);
 
 
@@ -65,10 +72,17 @@ int main(int argc, char **argv)
         opts.trainingParams.numRandomSplitTestsPerNode = numSplitTestsArg.getValue();
         opts.trainingParams.exponentialLambda = lambdaArg.getValue();
         opts.trainingParams.learningRate = learnArg.getValue();
+        opts.trainingParams.numResidualBasisVectors = numBasisArg.getValue();
+        opts.trainingParams.numSplitHistogramBins = numBinsArg.getValue();
+        opts.trainingParams.sampleFractionPerTree = sampleFractionArg.getValue();
+        opts.trainingParams.pixelFractionPerTree = pixelFractionArg.getValue();
+        opts.trainingParams.sampleStoreDirectory = storeDirArg.getValue();
         opts.randomSeed = randomSeedArg.getValue();
         
         opts.importParams.maxImageSideLength = maxImageSizeArg.getValue();
         opts.importParams.generateVerticallyMirrored = mirrorImageArg.getValue();
+        opts.importParams.cropMargin = cropMarginArg.getValue();
+        opts.importParams.cropFaceSize = cropSizeArg.getValue();
         
         opts.showInitialSamples = showInitialSamplesArg.getValue();
         opts.db = databaseArg.getValue();
@@ -82,7 +96,7 @@ int main(int argc, char **argv)
 
     dest::core::InputData inputs;
     inputs.rnd.seed(static_cast<unsigned int>(opts.randomSeed));
-    if (!dest::io::importDatabase(opts.db, opts.rects, inputs.images, inputs.shapes, inputs.rects, opts.importParams)) {
+    if (!dest::io::importDatabase(opts.db, opts.rects, inputs.images, inputs.shapes, inputs.rects, opts.importParams, 0, &inputs.imageIds, &inputs.mirrored)) {
         std::cout << "Failed to load database." << std::endl;
         return -1;
     }
@@ -94,12 +108,12 @@ int main(int argc, char **argv)
     dest::core::SampleData::createTrainingSamples(td, opts.createParams);
 	
     if (opts.showInitialSamples) {
-        size_t i = 0;
+        int i = 0;
         bool done = false;
-        while (i < td.samples.size() && !done) {
-            dest::core::SampleData::Sample &s = td.samples[i];
+        while (i < td.numSamples() && !done) {
+            const dest::core::ShapeTransform &shapeToImage = td.shapeToImage(i);
 			
-            cv::Mat tmp = dest::util::drawShape(td.input->images[s.inputIdx], s.shapeToImage * s.estimate.colwise().homogeneous(), cv::Scalar(0, 255, 0));
+            cv::Mat tmp = dest::util::drawShape(td.image(i), shapeToImage * td.estimate(i).colwise().homogeneous(), cv::Scalar(0, 255, 0));
 			//dest::core::Rect r = s.shapeToImage * dest::core::unitRectangle().colwise().homogeneous();
 			/*
 			dest::core::Rect r;
@@ -114,7 +128,7 @@ int main(int argc, char **argv)
 			r(1, 2) = shape_to_image(1, 2);
 			r(1, 3) = shape_to_image(1, 3);
 			*/
-            dest::core::Shape target = s.shapeToImage * s.target.colwise().homogeneous();
+            dest::core::Shape target = shapeToImage * td.target(i).colwise().homogeneous();
             dest::util::drawShape(tmp, target, cv::Scalar(255,255,255));
             //dest::util::drawRect(tmp, r, cv::Scalar(0,255,0));
             
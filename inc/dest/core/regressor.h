@@ -16,6 +16,7 @@
 #include <dest/core/training_data.h>
 #include <dest/io/dest_io_generated.h>
 #include <memory>
+#include <vector>
 
 namespace dest {
     namespace core {
@@ -31,6 +32,12 @@ namespace dest {
             
             /**
                 Fit to training data.
+
+                Adds the incremental shape update the trained regressor predicts to the estimate of
+                each training sample. The update equals the result of predict() for the training
+                sample without resampling the image.
+
+                \param t Training data.
             */
             bool fit(RegressorTraining &t);
             
@@ -43,6 +50,48 @@ namespace dest {
             */
             ShapeResidual predict(const Image &img, const Shape &shape, const ShapeTransform &shapeToImage) const;
 
+            /**
+                Compress leaf residuals through vector quantization.
+
+                Clusters the residuals of all tree leaves into a shared codebook using k-means.
+                Afterwards each leaf stores the index of its closest codebook entry only. Prediction
+                resolves codebook entries transparently.
+
+                \param codebookSize Maximum number of codebook entries.
+                \param rnd Random number generator used to seed clusters.
+            */
+            void quantizeLeaves(int codebookSize, std::mt19937 &rnd);
+
+            /**
+                Number of trees in forest.
+            */
+            int numTrees() const;
+
+            /**
+                Remove trees from forest.
+
+                Mean residual, codebook and residual basis are left untouched, so predictions
+                of the remaining trees stay unchanged.
+
+                \param treeIds Indices of trees to remove. Invalid indices are ignored.
+            */
+            void removeTrees(const std::vector<int> &treeIds);
+
+            /**
+                Number of times each pixel coordinate is referenced by splits of any tree.
+            */
+            Eigen::VectorXi pixelUsage() const;
+
+            /**
+                Remove pixel coordinates not referenced by any split.
+
+                Split indices are remapped accordingly, so predictions remain unchanged while
+                fewer pixels need to be sampled.
+
+                \returns the number of removed pixel coordinates.
+            */
+            int removeUnusedPixels();
+
             /**
                 Save trained regressor to flatbuffers.
             */
@@ -55,8 +104,8 @@ namespace dest {
             
         private:
             
-            PixelCoordinates sampleCoordinates(RegressorTraining &t) const;
-            void readPixelIntensities(const Eigen::AffineCompact3f &shapeToShape, const Eigen::AffineCompact3f &shapeToImage, const Shape &s, const Image &i, PixelIntensities &intensities) const;
+            PixelCoordinates sampleCoordinates(const RegressorTraining &t) const;
+            void readPixelIntensities(const Eigen::AffineCompact3f &shapeToShape, const Eigen::AffineCompact3f &shapeToImage, const Eigen::Ref<const Shape> &s, const Image &i, PixelIntensities &intensities) const;
             
             struct data;
             std::unique_ptr<data> _data;
@@ -13,6 +13,7 @@
 
 #include <Eigen/Geometry>
 #include <dest/core/image.h>
+#include <memory>
 
 namespace dest {
     namespace core {
@@ -41,6 +42,50 @@ namespace dest {
         */
         Eigen::AffineCompact3f estimateSimilarityTransform(const Eigen::Ref<const Shape> &from, const Eigen::Ref<const Shape> &to);
 
+        /**
+            Spatial index over shape landmarks.
+
+            Answers nearest landmark queries for arbitrary locations. Landmarks are organized
+            in a balanced k-d tree, so that a query visits only a few landmarks on average
+            instead of all of them. Ties are resolved in favor of the lower landmark index.
+        */
+        class LandmarkIndex {
+        public:
+            LandmarkIndex();
+            LandmarkIndex(const LandmarkIndex &other);
+            ~LandmarkIndex();
+
+            /**
+                Build index over the landmarks of the given shape.
+            */
+            explicit LandmarkIndex(const Shape &s);
+
+            /**
+                Rebuild index over the landmarks of the given shape.
+            */
+            void create(const Shape &s);
+
+            /**
+                Find the landmark closest to the given location.
+
+                \param x Location in the coordinate frame of the indexed shape.
+                \returns Index of closest landmark or -1 if the indexed shape is empty.
+            */
+            int closestLandmark(const Eigen::Ref<const Eigen::Vector3f> &x) const;
+
+            /**
+                Find the closest landmark for each location.
+
+                \param x Locations in columns.
+                \param closestLandmarks Index of closest landmark per location.
+            */
+            void closestLandmarks(const PixelCoordinates &x, Eigen::VectorXi &closestLandmarks) const;
+
+        private:
+            struct data;
+            std::unique_ptr<data> _data;
+        };
+
         /**
             Encode pixel coordinates relative to shape.
 
@@ -49,7 +94,8 @@ namespace dest {
             to the current shape estimate a crude approximation is performed by a single similarity transform in addition to local
             translations.
 
-            For each absolute pixel coordinate this method looks up the nearest landmark and computes its relative offset.
+            For each absolute pixel coordinate this method looks up the nearest landmark using a LandmarkIndex and computes its
+            relative offset.
 
             \param s Shape landmarks.
             \param abscoords Absolute pixel coordinates.
@@ -23,7 +23,10 @@ namespace dest {
         */
         class DistanceNormalizer {
         public:
-            virtual float operator()(const SampleData::Sample &s) const = 0;
+            /**
+                Normalization factor of distances measured for the given target shape.
+            */
+            virtual float operator()(const Shape &target) const = 0;
         };
         
         /**
@@ -32,7 +35,7 @@ namespace dest {
         class ConstantDistanceNormalizer : public DistanceNormalizer {
         public:
             ConstantDistanceNormalizer(float c);
-            virtual float operator()(const SampleData::Sample &s) const;
+            virtual float operator()(const Shape &target) const;
         private:
             float _c;
         };
@@ -44,7 +47,7 @@ namespace dest {
         public:
             LandmarkDistanceNormalizer();
             LandmarkDistanceNormalizer(int landmarkId0, int landmarkId1);
-            virtual float operator()(const SampleData::Sample &s) const;
+            virtual float operator()(const Shape &target) const;
             
             static LandmarkDistanceNormalizer createInterocularNormalizerIMM();
             static LandmarkDistanceNormalizer createInterocularNormalizerIBug();
@@ -71,6 +74,48 @@ namespace dest {
             \param norm Functor providing a distance normalization factor per sample.
         */ 
         TestResult testTracker(SampleData &td, const Tracker &t, const DistanceNormalizer &norm);
+
+        /**
+            Parameters for tree pruning.
+        */
+        struct PruneParameters {
+            /** Maximum tolerated increase of mean normalized error compared to unpruned tracker. Defaults to 0.001. */
+            float maxErrorIncrease;
+
+            /** Number of consecutive trees evaluated and removed together. Defaults to 10. */
+            int groupSize;
+
+            /** When true, only whole trailing groups of each cascade are removed. Defaults to false. */
+            bool trailingOnly;
+
+            PruneParameters();
+        };
+
+        struct PruneResult {
+            TestResult before;
+            TestResult after;
+            int numTreesBefore;
+            int numTreesAfter;
+        };
+
+        /**
+            Remove trees with negligible contribution to tracker accuracy.
+
+            The marginal contribution of each group of trees is measured as the change of mean
+            normalized error on the given validation samples when the group is removed. Cascades
+            are visited from last to first and groups within cascades from last to first. A group
+            is removed if the error of the remaining tracker stays within the tolerated increase
+            with respect to the unpruned tracker.
+
+            Each candidate removal requires a full evaluation of the validation set, so prefer a
+            moderately sized held-out set that was not used for training.
+
+            \param td Validation samples. Sample estimates are overwritten.
+            \param t Tracker to prune in place.
+            \param norm Functor providing a distance normalization factor per sample.
+            \param params Pruning parameters.
+        */
+        PruneResult pruneTracker(SampleData &td, Tracker &t, const DistanceNormalizer &norm, const PruneParameters &params = PruneParameters());
         
     }
 }
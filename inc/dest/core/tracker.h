@@ -66,6 +66,48 @@ namespace dest {
             */
             Shape predict(const Image &img, const ShapeTransform &shapeToImage, std::vector<Shape> *stepResults = 0) const;
 
+            /**
+                Compress leaf residuals of each cascade through vector quantization.
+
+                Leaves of a single cascade share a codebook of residuals and store only indices into
+                it. This considerably reduces model size at a slight loss of accuracy. Use testTracker
+                to validate accuracy afterwards.
+
+                \param codebookSize Maximum number of codebook entries per cascade.
+                \param rnd Random number generator used to seed clusters.
+            */
+            void quantizeLeaves(int codebookSize, std::mt19937 &rnd);
+
+            /**
+                Number of regressors in cascade.
+            */
+            int numCascades() const;
+
+            /**
+                Number of trees in the given cascade.
+            */
+            int numTrees(int cascade) const;
+
+            /**
+                Remove trees from the given cascade.
+
+                \param cascade Index of cascade.
+                \param treeIds Indices of trees to remove within cascade.
+            */
+            void removeTrees(int cascade, const std::vector<int> &treeIds);
+
+            /**
+                Number of times each pixel coordinate of the given cascade is referenced by tree splits.
+            */
+            Eigen::VectorXi pixelUsage(int cascade) const;
+
+            /**
+                Remove pixel coordinates not referenced by any tree split from all cascades.
+
+                \returns the total number of removed pixel coordinates.
+            */
+            int removeUnusedPixels();
+
             /**
                 Save trained tracker to flatbuffers.
             */
@@ -13,9 +13,11 @@
 
 #include <dest/core/shape.h>
 #include <dest/core/image.h>
+#include <dest/util/mapped_file.h>
 #include <vector>
 #include <random>
 #include <iosfwd>
+#include <string>
 
 namespace dest {
     namespace core {
@@ -61,6 +63,41 @@ namespace dest {
             */
             float expansionRandomPixelCoordinates;
 
+            /**
+                Number of residual basis vectors per cascade. When non-zero, each cascade learns a
+                PCA basis of its shape residuals and tree leaves store coefficients with respect to
+                this basis instead of full shape residuals. Defaults to 0 (disabled).
+            */
+            int numResidualBasisVectors;
+
+            /**
+                Number of histogram bins used to search split thresholds. When non-zero, pixel differences
+                of each split candidate are binned and all bin boundaries are evaluated as thresholds in
+                a single pass. Otherwise a single random threshold is tested per candidate. Defaults to 0.
+            */
+            int numSplitHistogramBins;
+
+            /**
+                Fraction of training samples each tree is fit on. Samples are drawn without replacement
+                per tree, while residuals of all samples are updated after each tree (stochastic gradient
+                boosting). Defaults to 1.
+            */
+            float sampleFractionPerTree;
+
+            /**
+                Fraction of random pixel coordinates each tree may choose split candidates from. The
+                subset is drawn without replacement per tree. Defaults to 1.
+            */
+            float pixelFractionPerTree;
+
+            /**
+                Directory to store per-cascade sample intensities and residuals in. When set, these
+                are kept in memory mapped temporary files, so that training sets larger than main
+                memory can be processed. Trees read stored samples sequentially, see Tree::fit.
+                Defaults to empty (keep in memory).
+            */
+            std::string sampleStoreDirectory;
+
             TrainingParameters();
         };
 
@@ -96,6 +133,19 @@ namespace dest {
             */
             ImageVector images;
 
+            /**
+                Index of the image of each shape.
+                Several shapes may refer to the same image. If empty, the i-th shape refers to the i-th image.
+            */
+            std::vector<int> imageIds;
+
+            /**
+                Flags marking shapes and rectangles given in coordinates of the horizontally mirrored image.
+                normalizeShapes folds the reflection into shapeToImage, so pixels of mirrored shapes are read
+                from the original image. If empty, no shape is mirrored.
+            */
+            std::vector<bool> mirrored;
+
             /**
                 A list of inverse shape normalizing transforms.
                 Use normalizeShapes to fill with defaults based on rectangles and unit rectangles.
@@ -104,9 +154,22 @@ namespace dest {
 
             /**
                 Random number generator used during training.
+                
+                Seeds the random streams used by sample creation and tracker training, see
+                createRandomStream. Also used directly by randomPartition.
             */
             std::mt19937 rnd;
 
+            /** Image of the i-th shape. */
+            const Image &image(int i) const {
+                return images[imageIds.empty() ? i : imageIds[i]];
+            }
+
+            /** Whether the i-th shape is given in mirrored image coordinates. */
+            bool isMirrored(int i) const {
+                return !mirrored.empty() && mirrored[i];
+            }
+
             /**
                 Automatically partition input into a training and validation set.
 
@@ -120,12 +183,28 @@ namespace dest {
                 Normalize shapes.
 
                 Used the corresponding rectangle and dest::unitRectangle() to find a shape normalizing transform.
-                Transforms shape and stores inverse transformation in shapeToImage.
+                Transforms shape and stores inverse transformation in shapeToImage. For mirrored
+                shapes the inverse transformation additionally maps back to original image coordinates.
             */
             static void normalizeShapes(InputData &input);
             
         };
 
+        /**
+            Create random number generator of an independent random stream.
+            
+            A stream is identified by a seed and up to three keys, such as cascade, tree and node
+            index. The same arguments always yield the same sequence, independent of the order
+            in which streams are created and of the thread consuming them. This allows random
+            decisions to be made in parallel while keeping training reproducible.
+            
+            \param seed Seed shared by related streams.
+            \param key0 First key.
+            \param key1 Second key, -1 if unused.
+            \param key2 Third key, -1 if unused.
+        */
+        std::mt19937 createRandomStream(unsigned int seed, int key0, int key1 = -1, int key2 = -1);
+        
         /**
             Parameters to control training sample creation from input data.
         */
@@ -157,31 +236,97 @@ namespace dest {
         */
         std::ostream& operator<<(std::ostream &stream, const SampleCreationParameters &obj);
 
+        /** Matrix of per-sample values, one row per sample. */
+        typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> SampleMatrix;
+        
+        /** View of a sample matrix stored in a SampleStorage. */
+        typedef Eigen::Map<SampleMatrix> SampleMatrixMap;
+        
         /**
-            Generated training samples.
+            Storage of a sample matrix.
+
+            Keeps values in memory or in a memory mapped temporary file.
         */
-        struct SampleData {
+        struct SampleStorage {
+            std::vector<float> memory;
+            util::MappedFile file;
+            
+            /**
+                Allocate storage and bind matrix view to it. Previous values are discarded.
 
+                \param m View to bind.
+                \param rows Number of rows.
+                \param cols Number of columns.
+                \param directory Directory to create mapped file in, empty to allocate from memory.
+                    Falls back to memory if mapping fails.
+            */
+            void allocate(SampleMatrixMap &m, int rows, int cols, const std::string &directory);
+            
             /**
-                A training sample.
+                Allocate storage and bind column-major matrix view to it. Previous values are discarded.
             */
-            struct Sample {
-                int inputIdx;
-                Shape estimate;
-                Shape target;
-                ShapeTransform shapeToImage;
-            };
-            typedef std::vector<Sample> SampleVector;
+            void allocate(Eigen::Map<Eigen::MatrixXf> &m, int rows, int cols, const std::string &directory);
+        };
+        
+        /**
+            Generated training samples.
+
+            Each sample refers to an input shape by index, from which its target shape, image and
+            shape transform are looked up. Only the current shape estimates are stored per sample.
+        */
+        struct SampleData {
 
             SampleData(InputData &input);
 
             InputData *input;
-            SampleVector samples;
+            /** Index of input data of each sample. */
+            std::vector<int> inputIds;
+            /** Flattened shape estimates of all samples, one column of 3 * numLandmarks values per sample. */
+            Eigen::Map<Eigen::MatrixXf> estimates;
+            /** Storage of estimates. Memory mapped if params.sampleStoreDirectory is set when samples are created. */
+            SampleStorage estimateStorage;
             TrainingParameters params;
             Shape meanShape;
 
+            /** Number of samples. */
+            int numSamples() const {
+                return static_cast<int>(inputIds.size());
+            }
+
+            /** Number of landmarks of each shape. */
+            int numLandmarks() const {
+                return static_cast<int>(estimates.rows() / 3);
+            }
+
+            /** Target shape of sample. */
+            const Shape &target(int i) const {
+                return input->shapes[inputIds[i]];
+            }
+
+            /** Inverse shape normalizing transform of sample. */
+            const ShapeTransform &shapeToImage(int i) const {
+                return input->shapeToImage[inputIds[i]];
+            }
+
+            /** Image of sample. */
+            const Image &image(int i) const {
+                return input->image(inputIds[i]);
+            }
+
+            /** Current shape estimate of sample. */
+            Eigen::Map<Shape> estimate(int i) {
+                return Eigen::Map<Shape>(estimates.col(i).data(), 3, numLandmarks());
+            }
+
+            /** Current shape estimate of sample. */
+            Eigen::Map<const Shape> estimate(int i) const {
+                return Eigen::Map<const Shape>(estimates.col(i).data(), 3, numLandmarks());
+            }
+
             /**
                 Create training samples.
+                
+                Random estimates of each sample are drawn from a separate random stream.
             */
             static void createTrainingSamples(SampleData &td, const SampleCreationParameters &params);
 
@@ -193,6 +338,17 @@ namespace dest {
             static void createTestingSamples(SampleData &td);
         };
 
+        /**
+            Compute the mean of all sample estimates.
+            
+            Samples are summed in double precision over blocks processed in parallel, followed by a
+            pairwise reduction of block sums. Suitable for any number of samples and independent of
+            the number of threads.
+            
+            \returns Mean shape or an empty shape if there are no samples.
+        */
+        Shape computeMeanShape(const SampleData &td);
+        
         /**
             Input data for regressor training.
         */
@@ -202,30 +358,101 @@ namespace dest {
             SampleData *training;
             Shape meanShape;
             int numLandmarks;
+            /** Seed of random streams used during training. */
+            unsigned int randomSeed;
+            /** Index of cascade being trained, used as random stream key. */
+            int cascade;
         };
 
+        /**
+            Distribution over ordered pairs of distinct pixel coordinates.
+            
+            Pair (i, j) is drawn with probability proportional to exp(-d / lambda), where d is
+            the distance between both pixel coordinates. Closer pairs are thus preferred when
+            generating split candidates. Precomputed as alias table over all pairs, so that
+            drawing a pair takes constant time.
+
+            Draws can be restricted to a subset of pixels. Pairs outside the subset are rejected,
+            so the table is built only once for all subsets.
+        */
+        struct PixelPairDistribution {
+            /** Number of pixel coordinates. */
+            int numPixels;
+            /** Probability of keeping the drawn pair, one per pair. */
+            std::vector<float> probabilities;
+            /** Pair to use instead if the drawn pair isn't kept, one per pair. */
+            std::vector<int> aliases;
+            /** Position of each pixel in the subset drawn from, -1 if excluded. Empty for all pixels. */
+            std::vector<int> subsetIndex;
+            /** Number of pixels in the subset drawn from. */
+            int numSubsetPixels;
+            
+            PixelPairDistribution();
+            
+            /**
+                Build distribution for the given pixel coordinates. Draws are not restricted.
+            */
+            void create(const PixelCoordinates &coords, float lambda);
+            
+            /**
+                Restrict draws to pairs of the given pixels.
+
+                \param pixelIds Distinct pixel indices. Indices drawn afterwards refer to positions in
+                    pixelIds. Empty to draw from all pixels.
+            */
+            void setSubset(const std::vector<int> &pixelIds);
+            
+            /**
+                Draw a pair of pixel indices.
+                
+                Falls back to a uniformly drawn pair if the subset holds too few probable pairs.
+
+                \returns false if there are less than two pixels to draw from.
+            */
+            bool sample(std::mt19937 &rnd, int &idx1, int &idx2) const;
+        };
+        
         /**
             Input data for tree training.
         */
         struct TreeTraining {
-            struct Sample {
-                ShapeResidual residual;
-                PixelIntensities intensities;
-
-                friend inline void swap(Sample& a, Sample& b)
-                {
-                    using std::swap;
-                    swap(a.residual, b.residual);
-                    swap(a.intensities, b.intensities);
-                }
-            };
-            typedef std::vector<Sample> SampleVector;
+            typedef core::SampleMatrix SampleMatrix;
+
+            TreeTraining();
 
             InputData *input;
             SampleData *training;
-            SampleVector samples;
+            /** Pixel intensities, one row per sample. */
+            SampleMatrixMap intensities;
+            SampleStorage intensityStorage;
+            /** Flattened shape residuals or their coefficients with respect to the residual basis, one row per sample. */
+            SampleMatrixMap residuals;
+            SampleStorage residualStorage;
+            /** Permutation of sample indices. Tree nodes refer to contiguous ranges of it. */
+            std::vector<int> sampleIds;
+            /** Leaf node each sample was assigned to during the last tree fit, -1 for samples not in sampleIds. */
+            std::vector<int> sampleLeaves;
+            /**
+                Intensities of the samples in sampleIds, one row per pixel and one column per entry of
+                sampleIds. Gathered by Tree::fit and partitioned along with sampleIds, so each tree node
+                reads contiguous segments of pixel rows.
+            */
+            SampleMatrixMap nodeIntensities;
+            SampleStorage nodeIntensityStorage;
+            /** Residuals of the samples in sampleIds, one row per entry of sampleIds. Partitioned along with sampleIds. */
+            SampleMatrixMap nodeResiduals;
+            SampleStorage nodeResidualStorage;
+            /** Columns of intensities the tree is fit to, empty for all columns. Split pixel indices refer to positions in it. */
+            std::vector<int> pixelIds;
             PixelCoordinates pixelCoordinates;
-            int numLandmarks;
+            /** Distribution of split candidate pixel pairs over pixelCoordinates, restricted to pixelIds. */
+            PixelPairDistribution pixelPairs;
+            int residualDims;
+            /** Seed of random streams used during training. */
+            unsigned int randomSeed;
+            /** Index of cascade and tree being trained, used as random stream keys. */
+            int cascade;
+            int tree;
         };
     }
 }
@@ -31,10 +31,18 @@ namespace dest {
             converge to true shape) in the left child and and the mean of shape residuals in the left
             node plus the same thing for right child.
 
+            Optionally, instead of a single random threshold, the pixel differences of each candidate
+            are binned into a histogram over [-64, 64] and every bin boundary is tested as threshold.
+
             This tree is stored implicitely as linear array as in GBDT we usually deal with
             shallow trees without many empty branches.
 
-            Provides parallelization of split position testing when OpenMP is enabled.
+            Provides parallelization of split position testing when OpenMP is enabled. Depending on
+            the number of samples in a node, split candidates are evaluated in parallel or the samples
+            of all candidates are processed in parallel blocks. Nodes of a level too small for block
+            processing are split in parallel with each other instead. Split candidates of each node are
+            drawn from a random stream keyed by cascade, tree and node index, so results do not
+            depend on the number of threads.
 
             Based on the work of
             [1] Kazemi, Vahid, and Josephine Sullivan.
@@ -50,6 +58,14 @@ namespace dest {
 
             /**
                 Fit tree to training data.
+
+                Records the leaf each training sample ends up in, so that tree predictions of
+                training samples don't need to be recomputed.
+
+                Intensities and residuals of the samples in TreeTraining::sampleIds are first copied
+                in ascending sample order. Each split partitions the samples of its node in place, so
+                every node reads a contiguous range of each pixel row and of residual rows, and stored
+                samples are accessed sequentially.
             */
             bool fit(TreeTraining &t);
 
@@ -57,9 +73,53 @@ namespace dest {
                 Predict incremental shape update from image intensities.
 
                 \param intensities Image intensities
-                \return Incremental shape update.
+                \return Flattened incremental shape update or its coefficients with respect
+                        to the residual basis the tree was trained with.
+            */
+            const Eigen::VectorXf &predict(const PixelIntensities &intensities) const;
+
+            /**
+                Residual stored in the given leaf node.
+
+                \param node Index of leaf node as recorded in TreeTraining::sampleLeaves.
             */
-            ShapeResidual predict(const PixelIntensities &intensities) const;
+            const Eigen::VectorXf &leafResidual(int node) const;
+
+            /**
+                Predict codebook index of incremental shape update from image intensities.
+
+                Only valid once leaves have been quantized.
+
+                \param intensities Image intensities
+                \return Index into codebook the tree leaves have been quantized with.
+            */
+            int predictCode(const PixelIntensities &intensities) const;
+
+            /**
+                Append residuals of all reachable leaves.
+            */
+            void collectLeafResiduals(std::vector<Eigen::VectorXf> &residuals) const;
+
+            /**
+                Replace leaf residuals by the index of their closest codebook entry.
+
+                \param codebook Flattened residuals in columns.
+            */
+            void quantizeLeaves(const Eigen::MatrixXf &codebook);
+
+            /**
+                Increment counts of pixel indices referenced by reachable split nodes.
+
+                \param counts Usage count per pixel index.
+            */
+            void countPixelUsage(Eigen::VectorXi &counts) const;
+
+            /**
+                Replace pixel indices of reachable split nodes.
+
+                \param newIndex Maps old pixel indices to new ones.
+            */
+            void remapPixels(const Eigen::VectorXi &newIndex);
 
             /**
                 Save tree to flatbuffers.
@@ -74,10 +134,16 @@ namespace dest {
         private:
 
             struct TreeNode;
-            struct PartitionPredicate;
             struct NodeInfo;
             struct SplitInfo;
 
+            /**
+                Split the given node if applicable, otherwise convert it into a leaf.
+
+                \returns true when the node was split.
+            */
+            bool fitNode(TreeTraining &t, const NodeInfo &n, NodeInfo &left, NodeInfo &right);
+
             /**
                 Split the given node if applicable.
             */
@@ -91,17 +157,70 @@ namespace dest {
             /**
                 Randomly generate split candidates.
             */
-            void sampleSplitPositions(TreeTraining &t, std::vector<SplitInfo> &splits) const;
+            void sampleSplitPositions(const TreeTraining &t, std::mt19937 &rnd, std::vector<SplitInfo> &splits) const;
+
+            /**
+                Find indices of all reachable leaf nodes and optionally of all reachable split nodes.
+            */
+            void findLeafNodes(std::vector<int> &leaves, std::vector<int> *splits = 0) const;
 
             /**
-                Compute the split energy for a single candidate.
+                Find index of leaf node reached by image intensities.
             */
-            float splitEnergy(TreeTraining &t, const NodeInfo &parent, const ShapeResidual &parentMeanResidual, const SplitInfo &split) const;
+            int findLeafNode(const PixelIntensities &intensities) const;
+
+            /**
+                Compute split energies for all candidates.
+
+                Small nodes are evaluated in parallel across candidates, large nodes in parallel
+                across blocks of samples.
+            */
+            void splitEnergies(TreeTraining &t, const NodeInfo &parent, const Eigen::VectorXf &parentMeanResidual, const std::vector<SplitInfo> &splits, std::vector<float> &energies) const;
+
+            /**
+                Evaluate split predicate for samples in range into a 0/1 mask.
+
+                Reads two contiguous pixel rows of node intensities.
+            */
+            static void splitMask(const TreeTraining &t, const std::pair<int, int> &range, const SplitInfo &split, Eigen::Ref<Eigen::VectorXf> mask);
+
+            /**
+                Sum residuals of samples in range that satisfy the predicate of each split candidate.
+
+                Predicates are evaluated into masks, so that left-child sums of all candidates
+                become a single matrix product over contiguous residual data.
+            */
+            void leftResidualSums(const TreeTraining &t, const std::pair<int, int> &range, const std::vector<SplitInfo> &splits, bool parallelSplits, Eigen::MatrixXf &sums, Eigen::VectorXi &counts) const;
+
+            /**
+                Compute split energies for all candidates by searching the best threshold of each.
+
+                Pixel differences of each candidate are binned into a histogram of residual sums.
+                Sweeping the bins evaluates all bin boundaries as thresholds. The best threshold
+                is stored in the candidate.
+            */
+            void splitEnergiesHistogram(TreeTraining &t, const NodeInfo &parent, const Eigen::VectorXf &parentMeanResidual, std::vector<SplitInfo> &splits, std::vector<float> &energies) const;
 
             struct data;
             std::unique_ptr<data> _data;
         };
 
+        /**
+            Lower boundary of histogram bin k when searching split thresholds with numBins bins.
+            Boundaries divide [-64, 64] into equally sized bins.
+        */
+        float splitHistogramBoundary(int k, int numBins);
+
+        /**
+            Histogram bin of a pixel difference when searching split thresholds with numBins bins.
+
+            Bin b holds differences in (splitHistogramBoundary(b), splitHistogramBoundary(b + 1)],
+            the first and last bin are unbounded below and above. A difference is greater than
+            boundary k exactly when its bin is >= k, so evaluating boundaries on the histogram
+            agrees with partitioning samples by the split predicate.
+        */
+        int splitHistogramBin(float d, int numBins);
+
     }
 }
 
@@ -0,0 +1,58 @@
+/**
+    This file is part of Deformable Shape Tracking (DEST).
+
+    Copyright(C) 2015/2016 Christoph Heindl
+    All rights reserved.
+
+    This software may be modified and distributed under the terms
+    of the BSD license.See the LICENSE file for details.
+*/
+
+#ifndef DEST_CODEGEN_H
+#define DEST_CODEGEN_H
+
+#include <dest/core/tracker.h>
+#include <iosfwd>
+#include <string>
+
+namespace dest {
+    namespace io {
+
+        /**
+            Options when generating C++ source from trained trackers.
+        */
+        struct CodegenParameters {
+            /** Namespace of generated code. Defaults to "dest_generated". */
+            std::string namespaceName;
+
+            /** Name of generated prediction function. Defaults to "predict". */
+            std::string functionName;
+
+            CodegenParameters();
+        };
+
+        /**
+            Generate C++ source code for a trained tracker.
+
+            Compiles the tracker ahead-of-time into a specialized prediction function
+
+                dest::core::Shape <namespaceName>::<functionName>(const dest::core::Image &img,
+                                                                   const dest::core::ShapeTransform &shapeToImage);
+
+            that computes the same result as dest::core::Tracker::predict. Each tree is turned into
+            straight-line comparison code with constant thresholds and pixel indices. Leaf residuals
+            are stored as static aligned arrays with the learning rate already folded in. Trackers
+            trained with a residual basis accumulate leaf coefficients first and reconstruct the shape
+            update once per cascade. The generated source depends on DEST headers only for similarity
+            estimation and image sampling.
+
+            \param t Trained tracker.
+            \param os Stream to write generated source to.
+            \param opts Generation options.
+            \returns true on success, false otherwise.
+        */
+        bool generateTrackerSource(const core::Tracker &t, std::ostream &os, const CodegenParameters &opts = CodegenParameters());
+    }
+}
+
+#endif
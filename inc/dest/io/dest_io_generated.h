@@ -99,6 +99,7 @@ struct TreeNode FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   int32_t idx2() const { return GetField<int32_t>(6, 0); }
   float threshold() const { return GetField<float>(8, 0); }
   const MatrixF *mean() const { return GetPointer<const MatrixF *>(10); }
+  int32_t code() const { return GetField<int32_t>(12, -1); }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<int32_t>(verifier, 4 /* idx1 */) &&
@@ -106,6 +107,7 @@ struct TreeNode FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
            VerifyField<float>(verifier, 8 /* threshold */) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, 10 /* mean */) &&
            verifier.VerifyTable(mean()) &&
+           VerifyField<int32_t>(verifier, 12 /* code */) &&
            verifier.EndTable();
   }
 };
@@ -117,10 +119,11 @@ struct TreeNodeBuilder {
   void add_idx2(int32_t idx2) { fbb_.AddElement<int32_t>(6, idx2, 0); }
   void add_threshold(float threshold) { fbb_.AddElement<float>(8, threshold, 0); }
   void add_mean(flatbuffers::Offset<MatrixF> mean) { fbb_.AddOffset(10, mean); }
+  void add_code(int32_t code) { fbb_.AddElement<int32_t>(12, code, -1); }
   TreeNodeBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
   TreeNodeBuilder &operator=(const TreeNodeBuilder &);
   flatbuffers::Offset<TreeNode> Finish() {
-    auto o = flatbuffers::Offset<TreeNode>(fbb_.EndTable(start_, 4));
+    auto o = flatbuffers::Offset<TreeNode>(fbb_.EndTable(start_, 5));
     return o;
   }
 };
@@ -129,8 +132,10 @@ inline flatbuffers::Offset<TreeNode> CreateTreeNode(flatbuffers::FlatBufferBuild
    int32_t idx1 = 0,
    int32_t idx2 = 0,
    float threshold = 0,
-   flatbuffers::Offset<MatrixF> mean = 0) {
+   flatbuffers::Offset<MatrixF> mean = 0,
+   int32_t code = -1) {
   TreeNodeBuilder builder_(_fbb);
+  builder_.add_code(code);
   builder_.add_mean(mean);
   builder_.add_threshold(threshold);
   builder_.add_idx2(idx2);
@@ -180,6 +185,8 @@ struct Regressor FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const MatrixF *meanShape() const { return GetPointer<const MatrixF *>(10); }
   const flatbuffers::Vector<flatbuffers::Offset<Tree>> *forest() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<Tree>> *>(12); }
   float learningRate() const { return GetField<float>(14, 0); }
+  const MatrixF *codebook() const { return GetPointer<const MatrixF *>(16); }
+  const MatrixF *residualBasis() const { return GetPointer<const MatrixF *>(18); }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, 4 /* pixelCoordinates */) &&
@@ -194,6 +201,10 @@ struct Regressor FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
            verifier.Verify(forest()) &&
            verifier.VerifyVectorOfTables(forest()) &&
            VerifyField<float>(verifier, 14 /* learningRate */) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 16 /* codebook */) &&
+           verifier.VerifyTable(codebook()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, 18 /* residualBasis */) &&
+           verifier.VerifyTable(residualBasis()) &&
            verifier.EndTable();
   }
 };
@@ -207,10 +218,12 @@ struct RegressorBuilder {
   void add_meanShape(flatbuffers::Offset<MatrixF> meanShape) { fbb_.AddOffset(10, meanShape); }
   void add_forest(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<Tree>>> forest) { fbb_.AddOffset(12, forest); }
   void add_learningRate(float learningRate) { fbb_.AddElement<float>(14, learningRate, 0); }
+  void add_codebook(flatbuffers::Offset<MatrixF> codebook) { fbb_.AddOffset(16, codebook); }
+  void add_residualBasis(flatbuffers::Offset<MatrixF> residualBasis) { fbb_.AddOffset(18, residualBasis); }
   RegressorBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
   RegressorBuilder &operator=(const RegressorBuilder &);
   flatbuffers::Offset<Regressor> Finish() {
-    auto o = flatbuffers::Offset<Regressor>(fbb_.EndTable(start_, 6));
+    auto o = flatbuffers::Offset<Regressor>(fbb_.EndTable(start_, 8));
     return o;
   }
 };
@@ -221,8 +234,12 @@ inline flatbuffers::Offset<Regressor> CreateRegressor(flatbuffers::FlatBufferBui
    flatbuffers::Offset<MatrixF> meanShapeResidual = 0,
    flatbuffers::Offset<MatrixF> meanShape = 0,
    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<Tree>>> forest = 0,
-   float learningRate = 0) {
+   float learningRate = 0,
+   flatbuffers::Offset<MatrixF> codebook = 0,
+   flatbuffers::Offset<MatrixF> residualBasis = 0) {
   RegressorBuilder builder_(_fbb);
+  builder_.add_residualBasis(residualBasis);
+  builder_.add_codebook(codebook);
   builder_.add_learningRate(learningRate);
   builder_.add_forest(forest);
   builder_.add_meanShape(meanShape);
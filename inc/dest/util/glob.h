@@ -27,6 +27,19 @@ namespace dest {
             \returns List of found files.
         */
         std::vector<std::string> findFilesInDir(const std::string &directory, const std::string &extension, bool stripExtension, bool recursive);
+
+        /**
+            Find all files in directory having one of the given extensions.
+
+            Traverses the directory only once, regardless of the number of extensions.
+
+            \param Directory to search in.
+            \param extensions Accepted file extensions.
+            \param stripExtension Whether or not to strip extension in results.
+            \param recursive Traverse sub-directories too.
+            \returns List of found files.
+        */
+        std::vector<std::string> findFilesInDir(const std::string &directory, const std::vector<std::string> &extensions, bool stripExtension, bool recursive);
         
     }
 }
@@ -0,0 +1,68 @@
+/**
+    This file is part of Deformable Shape Tracking (DEST).
+
+    Copyright(C) 2015/2016 Christoph Heindl
+    All rights reserved.
+
+    This software may be modified and distributed under the terms
+    of the BSD license.See the LICENSE file for details.
+*/
+
+#ifndef DEST_MAPPED_FILE_H
+#define DEST_MAPPED_FILE_H
+
+#include <string>
+#include <memory>
+
+namespace dest {
+    namespace util {
+        
+        /**
+            Temporary file mapped into memory.
+
+            Provides memory that is backed by a file instead of the page file, so that the operating
+            system can page it in and out on demand. The file is removed once closed.
+        */
+        class MappedFile {
+        public:
+            MappedFile();
+            ~MappedFile();
+            
+            /**
+                Create temporary file of the given size in directory and map it.
+
+                Previously mapped files are closed first.
+
+                \param directory Directory to create file in.
+                \param size Size in bytes.
+                \returns true on success, false otherwise.
+            */
+            bool create(const std::string &directory, size_t size);
+            
+            /**
+                Unmap and remove file.
+            */
+            void close();
+            
+            /**
+                Pointer to mapped memory or null when not mapped.
+            */
+            void *memory() const;
+            
+            /**
+                Size of mapped memory in bytes.
+            */
+            size_t size() const;
+            
+        private:
+            MappedFile(const MappedFile &other);
+            MappedFile &operator=(const MappedFile &other);
+            
+            struct data;
+            std::unique_ptr<data> _data;
+        };
+        
+    }
+}
+
+#endif
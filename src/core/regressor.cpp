@@ -10,9 +10,12 @@
 
 #include <dest/core/regressor.h>
 #include <dest/core/tree.h>
+#include <dest/core/config.h>
 #include <dest/util/log.h>
 #include <dest/io/dest_io_generated.h>
 #include <dest/io/matrix_io.h>
+#include <Eigen/Eigenvalues>
+#include <algorithm>
 
 namespace dest {
     namespace core {
@@ -26,6 +29,8 @@ namespace dest {
             Shape meanShape;
             std::vector<Tree> trees;
             float learningRate;
+            Eigen::MatrixXf codebook;
+            Eigen::MatrixXf residualBasis;
             
             data()
             {}
@@ -43,6 +48,16 @@ namespace dest {
                 }
                 auto vtrees = fbb.CreateVector(ltrees);
 
+                flatbuffers::Offset<io::MatrixF> lcodebook = 0;
+                if (codebook.size() > 0) {
+                    lcodebook = io::toFbs(fbb, codebook);
+                }
+
+                flatbuffers::Offset<io::MatrixF> lbasis = 0;
+                if (residualBasis.size() > 0) {
+                    lbasis = io::toFbs(fbb, residualBasis);
+                }
+
                 io::RegressorBuilder b(fbb);
                 b.add_closestLandmarks(lcosest);
                 b.add_pixelCoordinates(lpixels);
@@ -50,6 +65,8 @@ namespace dest {
                 b.add_meanShape(lmeans);
                 b.add_forest(vtrees);
                 b.add_learningRate(learningRate);
+                b.add_codebook(lcodebook);
+                b.add_residualBasis(lbasis);
 
                 return b.Finish();
             }
@@ -62,6 +79,18 @@ namespace dest {
                 io::fromFbs(*fbs.meanShape(), meanShape);
                 learningRate = fbs.learningRate();
 
+                if (fbs.codebook()) {
+                    io::fromFbs(*fbs.codebook(), codebook);
+                } else {
+                    codebook.resize(0, 0);
+                }
+
+                if (fbs.residualBasis()) {
+                    io::fromFbs(*fbs.residualBasis(), residualBasis);
+                } else {
+                    residualBasis.resize(0, 0);
+                }
+
                 trees.resize(fbs.forest()->size());
                 for (flatbuffers::uoffset_t i = 0; i < fbs.forest()->size(); ++i) {
                     trees[i].load(*fbs.forest()->Get(i));
@@ -99,58 +128,202 @@ namespace dest {
             data.learningRate = t.training->params.learningRate;
             data.trees.resize(t.training->params.numTrees);
             data.meanShape = t.meanShape;
+            data.codebook.resize(0, 0);
+            data.residualBasis.resize(0, 0);
+            
+            const int numResiduals = 3 * t.numLandmarks;
             
             TreeTraining tt;
-            tt.numLandmarks = t.numLandmarks;
+            tt.residualDims = numResiduals;
             tt.training = t.training;
             tt.input = t.input;
-            tt.samples.resize(t.training->samples.size());
+            tt.randomSeed = t.randomSeed;
+            tt.cascade = t.cascade;
             
             // Draw random samples
             tt.pixelCoordinates = sampleCoordinates(t);
             
+            // Split candidates prefer close pixel pairs. Built once, trees drawing from a pixel
+            // subset reject pairs outside of it.
+            tt.pixelPairs.create(tt.pixelCoordinates, t.training->params.exponentialLambda);
+            
             // Encode them with respect to the mean shape
             shapeRelativePixelCoordinates(t.meanShape, tt.pixelCoordinates, data.shapeRelativePixelCoordinates, data.closestShapeLandmark);
             
-            // Compute the mean residual, to be used as base learner
-            data.meanResidual = ShapeResidual::Zero(3, t.numLandmarks);
-            for (size_t i = 0; i < tdata.samples.size(); ++i) {
+            const int numSamples = tdata.numSamples();
+            const std::string &storeDirectory = t.training->params.sampleStoreDirectory;
+            
+            const int numPixels = static_cast<int>(tt.pixelCoordinates.cols());
+            const float pixelFraction = std::min<float>(t.training->params.pixelFractionPerTree, 1.f);
+            const int numTreePixels = std::max<int>(static_cast<int>(pixelFraction * numPixels + 0.5f), 2);
+            const bool subsamplePixels = numTreePixels < numPixels;
+            
+            tt.intensityStorage.allocate(tt.intensities, numSamples, numPixels, storeDirectory);
+            SampleMatrixMap &intensities = tt.intensities;
+            
+            // Extract residuals and features, samples are independent of each other
+            tt.residualStorage.allocate(tt.residuals, numSamples, numResiduals, storeDirectory);
+            tt.sampleIds.resize(numSamples);
+            tt.sampleLeaves.assign(numSamples, -1);
+            
+#ifdef DEST_WITH_OPENMP
+            #pragma omp parallel for schedule(static)
+#endif
+            for (int i = 0; i < numSamples; ++i) {
 
-                tt.samples[i].residual = tdata.samples[i].target - tdata.samples[i].estimate;
-                data.meanResidual += tt.samples[i].residual;
+                const Eigen::Map<const Eigen::VectorXf> target(tdata.target(i).data(), numResiduals);
+                tt.residuals.row(i) = (target - tdata.estimates.col(i)).transpose();
+                tt.sampleIds[i] = i;
                 
-                Eigen::AffineCompact3f tShapeToShape = estimateSimilarityTransform(t.meanShape, tdata.samples[i].estimate);
-                Eigen::AffineCompact3f tShapeToImage = tdata.samples[i].shapeToImage;
+                Eigen::AffineCompact3f tShapeToShape = estimateSimilarityTransform(t.meanShape, tdata.estimate(i));
+                Eigen::AffineCompact3f tShapeToImage = tdata.shapeToImage(i);
 
+                PixelIntensities sampleIntensities;
                 readPixelIntensities(tShapeToShape,
                                      tShapeToImage,
-                                     tdata.samples[i].estimate,
-                                     t.input->images[tdata.samples[i].inputIdx],
-                                     tt.samples[i].intensities);
+                                     tdata.estimate(i),
+                                     tdata.image(i),
+                                     sampleIntensities);
+                intensities.row(i) = sampleIntensities.transpose();
+                
+            }
+            
+            // Compute the mean residual, to be used as base learner. Summed in sample order
+            // for reproducible results.
+            data.meanResidual = ShapeResidual::Zero(3, t.numLandmarks);
+            Eigen::Map<Eigen::VectorXf> meanResidualFlat(data.meanResidual.data(), numResiduals);
+            for (int i = 0; i < numSamples; ++i) {
+                meanResidualFlat += tt.residuals.row(i).transpose();
+            }
+            data.meanResidual /= static_cast<float>(numSamples);
+            
+            tt.residuals.rowwise() -= meanResidualFlat.transpose();
+            
+            // Optionally fit trees to coefficients of residuals with respect to a PCA basis
+            const int numBasisVectors = t.training->params.numResidualBasisVectors;
+            if (numBasisVectors > 0 && numBasisVectors < numResiduals) {
+                Eigen::MatrixXf cov = Eigen::MatrixXf::Zero(numResiduals, numResiduals);
+                cov.selfadjointView<Eigen::Lower>().rankUpdate(tt.residuals.transpose());
+                cov /= static_cast<float>(numSamples);
                 
+                // Eigenvalues are sorted in increasing order
+                Eigen::SelfAdjointEigenSolver<Eigen::MatrixXf> eig(cov);
+                data.residualBasis = eig.eigenvectors().rightCols(numBasisVectors).rowwise().reverse();
+                
+                const SampleMatrix coefficients = tt.residuals * data.residualBasis;
+                tt.residualStorage.allocate(tt.residuals, numSamples, numBasisVectors, storeDirectory);
+                tt.residuals = coefficients;
+                tt.residualDims = numBasisVectors;
             }
-            data.meanResidual /= static_cast<float>(tdata.samples.size());
             
 			//
+            const float sampleFraction = std::min<float>(t.training->params.sampleFractionPerTree, 1.f);
+            const int numTreeSamples = std::max<int>(static_cast<int>(sampleFraction * numSamples + 0.5f), 1);
+            std::vector<int> sampleIds(tt.sampleIds);
+            
+            std::vector<int> pixelIds(numPixels);
+            for (int i = 0; i < numPixels; ++i) {
+                pixelIds[i] = i;
+            }
+            
+            // Accumulated tree predictions per sample, in the same order as in predict(). These are
+            // coefficients with respect to the residual basis or shape updates starting at the mean residual.
+            const bool projected = data.residualBasis.size() > 0;
+            SampleStorage leafSumStorage;
+            SampleMatrixMap leafSums(0, 0, 0);
+            leafSumStorage.allocate(leafSums, numSamples, projected ? static_cast<int>(data.residualBasis.cols()) : numResiduals, storeDirectory);
+            if (projected) {
+                leafSums.setZero();
+            } else {
+                leafSums.rowwise() = meanResidualFlat.transpose();
+            }
+            
             for (int k = 0; k < t.training->params.numTrees; ++k) {
 				DEST_LOG("Building tree " << std::setw(5) << k + 1 << "\r");
-                for (size_t i = 0; i < tdata.samples.size(); ++i) {
+                
+                // Subsets of this tree are drawn from its own stream
+                std::mt19937 rnd = createRandomStream(t.randomSeed, t.cascade, k);
+                tt.tree = k;
+                
+                if (numTreeSamples < numSamples) {
+                    // Draw subsample without replacement, tree is fit to these samples only
+                    for (int i = 0; i < numTreeSamples; ++i) {
+                        std::uniform_int_distribution<int> di(i, numSamples - 1);
+                        std::swap(sampleIds[i], sampleIds[di(rnd)]);
+                    }
+                    tt.sampleIds.assign(sampleIds.begin(), sampleIds.begin() + numTreeSamples);
+                    std::fill(tt.sampleLeaves.begin(), tt.sampleLeaves.end(), -1);
+                }
+                
+                if (subsamplePixels) {
+                    // Draw pixel subset without replacement, the tree gathers these columns only
+                    for (int i = 0; i < numTreePixels; ++i) {
+                        std::uniform_int_distribution<int> di(i, numPixels - 1);
+                        std::swap(pixelIds[i], pixelIds[di(rnd)]);
+                    }
+                    std::sort(pixelIds.begin(), pixelIds.begin() + numTreePixels);
+                    tt.pixelIds.assign(pixelIds.begin(), pixelIds.begin() + numTreePixels);
+                    
+                    // Split candidates are drawn from the distribution over all pixels
+                    tt.pixelPairs.setSubset(tt.pixelIds);
+                }
+                
+                data.trees[k].fit(tt);
+                
+                if (subsamplePixels) {
+                    // Refer to pixels of the regressor instead of the slice
+                    data.trees[k].remapPixels(Eigen::Map<const Eigen::VectorXi>(&pixelIds[0], numTreePixels));
+                }
+                
+                // Samples the tree was fit to know their leaf, others need a prediction
+                const Tree &tree = data.trees[k];
+                
+#ifdef DEST_WITH_OPENMP
+                #pragma omp parallel for schedule(static)
+#endif
+                for (int i = 0; i < numSamples; ++i) {
+                    const Eigen::VectorXf *prediction;
+                    if (tt.sampleLeaves[i] >= 0) {
+                        prediction = &tree.leafResidual(tt.sampleLeaves[i]);
+                    } else {
+                        const PixelIntensities sampleIntensities = intensities.row(i).transpose();
+                        prediction = &tree.predict(sampleIntensities);
+                    }
                     
-                    if (k == 0) {
-                        tt.samples[i].residual -= data.meanResidual;
+                    tt.residuals.row(i) -= data.learningRate * prediction->transpose();
+                    
+                    if (projected) {
+                        leafSums.row(i) += prediction->transpose();
                     } else {
-                        tt.samples[i].residual -= data.learningRate * data.trees[k - 1].predict(tt.samples[i].intensities);
+                        leafSums.row(i) += data.learningRate * prediction->transpose();
                     }
                 }
-                data.trees[k].fit(tt);
             }
             
+            // Update shape estimates, reconstructing shape updates from accumulated coefficients if necessary
+#ifdef DEST_WITH_OPENMP
+            #pragma omp parallel for schedule(static)
+#endif
+            for (int i = 0; i < numSamples; ++i) {
+                if (projected) {
+                    const Eigen::VectorXf leafSum = leafSums.row(i).transpose();
+                    Eigen::VectorXf update = meanResidualFlat;
+                    update.noalias() += data.learningRate * (data.residualBasis * leafSum);
+                    tdata.estimates.col(i) += update;
+                } else {
+                    tdata.estimates.col(i) += leafSums.row(i).transpose();
+                }
+            }
+            
+            // Don't sample pixels that no tree ever reads
+            removeUnusedPixels();
+            
             
             
             return false;
         }
         
-        PixelCoordinates Regressor::sampleCoordinates(RegressorTraining &t) const {
+        PixelCoordinates Regressor::sampleCoordinates(const RegressorTraining &t) const {
             
             Eigen::Vector3f minC = t.meanShape.rowwise().minCoeff() - Eigen::Vector3f::Constant(t.training->params.expansionRandomPixelCoordinates);
             Eigen::Vector3f maxC = t.meanShape.rowwise().maxCoeff() + Eigen::Vector3f::Constant(t.training->params.expansionRandomPixelCoordinates);
@@ -158,21 +331,22 @@ namespace dest {
             const int numCoords = t.training->params.numRandomPixelCoordinates;
             PixelCoordinates result(3, numCoords);
             
+            std::mt19937 rnd = createRandomStream(t.randomSeed, t.cascade);
             std::uniform_real_distribution<float> dx(0.f, maxC.x() - minC.x());
             std::uniform_real_distribution<float> dy(0.f, maxC.y() - minC.y());
 			std::uniform_real_distribution<float> dz(0.f, maxC.z() - minC.z());
 
             for (int i = 0; i < numCoords; ++i) {
-                result(0, i) = minC.x() + dx(t.input->rnd);
-				result(1, i) = minC.y() + dy(t.input->rnd);
-				result(2, i) = minC.z() + dz(t.input->rnd);
+                result(0, i) = minC.x() + dx(rnd);
+				result(1, i) = minC.y() + dy(rnd);
+				result(2, i) = minC.z() + dz(rnd);
             }
             
             return result;
         }
         
         
-        void Regressor::readPixelIntensities(const Eigen::AffineCompact3f &shapeToShape, const Eigen::AffineCompact3f &shapeToImage, const Shape &s, const Image &img, PixelIntensities &intensities) const
+        void Regressor::readPixelIntensities(const Eigen::AffineCompact3f &shapeToShape, const Eigen::AffineCompact3f &shapeToImage, const Eigen::Ref<const Shape> &s, const Image &img, PixelIntensities &intensities) const
         {
             Regressor::data &data = *_data;
             
@@ -199,11 +373,218 @@ namespace dest {
             const size_t numTrees = data.trees.size();
             
             ShapeResidual sr = data.meanResidual;
-            for(size_t i = 0; i < numTrees; ++i) {
-                sr += data.trees[i].predict(intensities) * data.learningRate;
+            Eigen::Map<Eigen::VectorXf> srFlat(sr.data(), sr.size());
+            
+            if (data.codebook.size() == 0 && data.residualBasis.size() == 0) {
+                for(size_t i = 0; i < numTrees; ++i) {
+                    srFlat += data.trees[i].predict(intensities) * data.learningRate;
+                }
+                return sr;
+            }
+            
+            Eigen::VectorXf leafSum;
+            if (data.codebook.size() > 0) {
+                // Count codebook hits and resolve them all at once.
+                Eigen::VectorXf hits = Eigen::VectorXf::Zero(data.codebook.cols());
+                for (size_t i = 0; i < numTrees; ++i) {
+                    hits(data.trees[i].predictCode(intensities)) += 1.f;
+                }
+                leafSum.noalias() = data.codebook * hits;
+            } else {
+                leafSum = Eigen::VectorXf::Zero(data.residualBasis.cols());
+                for (size_t i = 0; i < numTrees; ++i) {
+                    leafSum += data.trees[i].predict(intensities);
+                }
+            }
+            
+            if (data.residualBasis.size() > 0) {
+                // Reconstruct shape update once from accumulated coefficients.
+                srFlat.noalias() += data.learningRate * (data.residualBasis * leafSum);
+            } else {
+                srFlat += data.learningRate * leafSum;
             }
             
             return sr;
         }
+        
+        int Regressor::numTrees() const
+        {
+            return static_cast<int>(_data->trees.size());
+        }
+        
+        void Regressor::removeTrees(const std::vector<int> &treeIds)
+        {
+            std::vector<Tree> &trees = _data->trees;
+            
+            std::vector<bool> remove(trees.size(), false);
+            for (size_t i = 0; i < treeIds.size(); ++i) {
+                if (treeIds[i] >= 0 && treeIds[i] < static_cast<int>(trees.size()))
+                    remove[treeIds[i]] = true;
+            }
+            
+            std::vector<Tree> kept;
+            for (size_t i = 0; i < trees.size(); ++i) {
+                if (!remove[i])
+                    kept.push_back(trees[i]);
+            }
+            trees.swap(kept);
+        }
+        
+        Eigen::VectorXi Regressor::pixelUsage() const
+        {
+            const Regressor::data &data = *_data;
+            
+            Eigen::VectorXi counts = Eigen::VectorXi::Zero(data.shapeRelativePixelCoordinates.cols());
+            for (size_t i = 0; i < data.trees.size(); ++i) {
+                data.trees[i].countPixelUsage(counts);
+            }
+            return counts;
+        }
+        
+        int Regressor::removeUnusedPixels()
+        {
+            Regressor::data &data = *_data;
+            
+            const Eigen::VectorXi counts = pixelUsage();
+            const int numPixels = static_cast<int>(counts.size());
+            
+            Eigen::VectorXi newIndex = Eigen::VectorXi::Constant(numPixels, -1);
+            int numUsed = 0;
+            for (int i = 0; i < numPixels; ++i) {
+                if (counts(i) > 0)
+                    newIndex(i) = numUsed++;
+            }
+            
+            if (numUsed == numPixels)
+                return 0;
+            
+            PixelCoordinates coords(3, numUsed);
+            Eigen::VectorXi closest(numUsed);
+            for (int i = 0; i < numPixels; ++i) {
+                if (newIndex(i) >= 0) {
+                    coords.col(newIndex(i)) = data.shapeRelativePixelCoordinates.col(i);
+                    closest(newIndex(i)) = data.closestShapeLandmark(i);
+                }
+            }
+            data.shapeRelativePixelCoordinates.swap(coords);
+            data.closestShapeLandmark.swap(closest);
+            
+            for (size_t i = 0; i < data.trees.size(); ++i) {
+                data.trees[i].remapPixels(newIndex);
+            }
+            
+            return numPixels - numUsed;
+        }
+        
+        /**
+            Lloyd's k-means on columns of x with k-means++ seeding.
+            
+            Returns cluster centers in columns. Empty clusters are dropped.
+        */
+        Eigen::MatrixXf kmeans(const Eigen::MatrixXf &x, int k, int maxIterations, std::mt19937 &rnd) {
+            const int n = static_cast<int>(x.cols());
+            k = std::min<int>(k, n);
+            
+            const Eigen::RowVectorXf xNorms = x.colwise().squaredNorm();
+            
+            // Seeding
+            Eigen::MatrixXf centers(x.rows(), k);
+            std::uniform_int_distribution<int> di(0, n - 1);
+            centers.col(0) = x.col(di(rnd));
+            
+            Eigen::RowVectorXf d2 = (x.colwise() - centers.col(0)).colwise().squaredNorm();
+            for (int c = 1; c < k; ++c) {
+                if (d2.sum() <= 0.f) {
+                    // Fewer distinct samples than clusters requested.
+                    k = c;
+                    centers.conservativeResize(Eigen::NoChange, k);
+                    break;
+                }
+                std::discrete_distribution<int> dd(d2.data(), d2.data() + n);
+                centers.col(c) = x.col(dd(rnd));
+                d2 = d2.cwiseMin((x.colwise() - centers.col(c)).colwise().squaredNorm());
+            }
+            
+            // Refinement
+            std::vector<int> assignment(n, -1);
+            for (int iter = 0; iter < maxIterations; ++iter) {
+                
+                // Squared distances up to a per-sample constant.
+                Eigen::MatrixXf d = (-2.f * (centers.transpose() * x)).colwise() + centers.colwise().squaredNorm().transpose();
+                
+                bool changed = false;
+                for (int i = 0; i < n; ++i) {
+                    Eigen::MatrixXf::Index best;
+                    d.col(i).minCoeff(&best);
+                    if (assignment[i] != static_cast<int>(best)) {
+                        assignment[i] = static_cast<int>(best);
+                        changed = true;
+                    }
+                }
+                
+                if (!changed)
+                    break;
+                
+                Eigen::VectorXf counts = Eigen::VectorXf::Zero(k);
+                centers.setZero();
+                for (int i = 0; i < n; ++i) {
+                    centers.col(assignment[i]) += x.col(i);
+                    counts(assignment[i]) += 1.f;
+                }
+                
+                for (int c = 0; c < k; ++c) {
+                    if (counts(c) > 0.f) {
+                        centers.col(c) /= counts(c);
+                    } else {
+                        // Re-seed empty cluster with a random sample.
+                        centers.col(c) = x.col(di(rnd));
+                    }
+                }
+            }
+            
+            // Drop unused centers
+            std::vector<bool> used(k, false);
+            for (int i = 0; i < n; ++i) {
+                if (assignment[i] >= 0)
+                    used[assignment[i]] = true;
+            }
+            
+            Eigen::MatrixXf result(x.rows(), std::count(used.begin(), used.end(), true));
+            for (int c = 0, j = 0; c < k; ++c) {
+                if (used[c])
+                    result.col(j++) = centers.col(c);
+            }
+            
+            return result;
+        }
+        
+        void Regressor::quantizeLeaves(int codebookSize, std::mt19937 &rnd)
+        {
+            Regressor::data &data = *_data;
+            
+            if (data.codebook.size() > 0 || data.trees.empty()) {
+                // Already quantized or not trained.
+                return;
+            }
+            
+            std::vector<Eigen::VectorXf> leaves;
+            for (size_t i = 0; i < data.trees.size(); ++i) {
+                data.trees[i].collectLeafResiduals(leaves);
+            }
+            
+            const int dims = static_cast<int>(data.residualBasis.size() > 0 ? data.residualBasis.cols() : data.meanResidual.size());
+            Eigen::MatrixXf x(dims, leaves.size());
+            for (size_t i = 0; i < leaves.size(); ++i) {
+                x.col(i) = leaves[i];
+            }
+            
+            data.codebook = kmeans(x, std::max<int>(codebookSize, 1), 50, rnd);
+            
+            for (size_t i = 0; i < data.trees.size(); ++i) {
+                data.trees[i].quantizeLeaves(data.codebook);
+            }
+            
+            DEST_LOG("Quantized " << leaves.size() << " leaves into " << data.codebook.cols() << " codebook entries." << std::endl);
+        }
     }
 }
\ No newline at end of file
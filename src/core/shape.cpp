@@ -10,6 +10,9 @@
 
 #include <dest/core/shape.h>
 #include <Eigen/Dense>
+#include <algorithm>
+#include <limits>
+#include <vector>
 
 namespace dest {
     namespace core {
@@ -67,36 +70,134 @@ namespace dest {
             return Eigen::AffineCompact3f(ret);
         }
         
-        int findClosestLandmarkIndex(const Shape &s, const Eigen::Ref<const Eigen::Vector3f> &x)
-        {
-            const int numLandmarks = static_cast<int>(s.cols());
+        struct LandmarkIndex::data {
+            Shape landmarks;
+            // Landmark indices in k-d tree order. The node of range [first, last) is stored
+            // at its median position (first + last) / 2.
+            std::vector<int> order;
+            // Split axis of each node, stored alongside order.
+            std::vector<int> axes;
             
-            int bestLandmark = -1;
-            float bestD2 = std::numeric_limits<float>::max();
+            void build(int first, int last) {
+                if (last - first < 1) {
+                    return;
+                }
+                
+                const int mid = (first + last) / 2;
+                
+                // Split along the axis of largest extent
+                Eigen::Vector3f minC = landmarks.col(order[first]);
+                Eigen::Vector3f maxC = minC;
+                for (int i = first + 1; i < last; ++i) {
+                    minC = minC.cwiseMin(landmarks.col(order[i]));
+                    maxC = maxC.cwiseMax(landmarks.col(order[i]));
+                }
+                int axis;
+                (maxC - minC).maxCoeff(&axis);
+                
+                const Shape &l = landmarks;
+                std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + last, [&l, axis](int a, int b) {
+                    return l(axis, a) < l(axis, b);
+                });
+                axes[mid] = axis;
+                
+                build(first, mid);
+                build(mid + 1, last);
+            }
             
-            for (int i = 0; i < numLandmarks; ++i) {
-                float d2 = (s.col(i) - x).squaredNorm();
-                if (d2 < bestD2) {
+            void search(int first, int last, const Eigen::Vector3f &x, int &best, float &bestD2) const {
+                if (last - first < 1) {
+                    return;
+                }
+                
+                const int mid = (first + last) / 2;
+                const int idx = order[mid];
+                
+                const float d2 = (landmarks.col(idx) - x).squaredNorm();
+                if (d2 < bestD2 || (d2 == bestD2 && idx < best)) {
                     bestD2 = d2;
-                    bestLandmark = i;
+                    best = idx;
                 }
+                
+                const float diff = x(axes[mid]) - landmarks(axes[mid], idx);
+                if (diff < 0.f) {
+                    search(first, mid, x, best, bestD2);
+                    if (diff * diff <= bestD2) {
+                        search(mid + 1, last, x, best, bestD2);
+                    }
+                } else {
+                    search(mid + 1, last, x, best, bestD2);
+                    if (diff * diff <= bestD2) {
+                        search(first, mid, x, best, bestD2);
+                    }
+                }
+            }
+        };
+        
+        LandmarkIndex::LandmarkIndex()
+        : _data(new data())
+        {}
+        
+        LandmarkIndex::LandmarkIndex(const LandmarkIndex &other)
+        : _data(new data(*other._data))
+        {}
+        
+        LandmarkIndex::LandmarkIndex(const Shape &s)
+        : _data(new data())
+        {
+            create(s);
+        }
+        
+        LandmarkIndex::~LandmarkIndex()
+        {}
+        
+        void LandmarkIndex::create(const Shape &s)
+        {
+            data &d = *_data;
+            
+            const int numLandmarks = static_cast<int>(s.cols());
+            d.landmarks = s;
+            d.order.resize(numLandmarks);
+            d.axes.assign(numLandmarks, 0);
+            for (int i = 0; i < numLandmarks; ++i) {
+                d.order[i] = i;
             }
             
-            return bestLandmark;
+            d.build(0, numLandmarks);
+        }
+        
+        int LandmarkIndex::closestLandmark(const Eigen::Ref<const Eigen::Vector3f> &x) const
+        {
+            const data &d = *_data;
+            
+            int best = -1;
+            float bestD2 = std::numeric_limits<float>::max();
+            d.search(0, static_cast<int>(d.order.size()), x, best, bestD2);
+            
+            return best;
         }
         
+        void LandmarkIndex::closestLandmarks(const PixelCoordinates &x, Eigen::VectorXi &closestLandmarks) const
+        {
+            const int numLocs = static_cast<int>(x.cols());
+            closestLandmarks.resize(numLocs);
+            
+            for (int i = 0; i < numLocs; ++i) {
+                closestLandmarks(i) = closestLandmark(x.col(i));
+            }
+        }
         
         void shapeRelativePixelCoordinates(const Shape &s, const PixelCoordinates &abscoords, PixelCoordinates &relcoords, Eigen::VectorXi &closestLandmarks)
         {
             
             relcoords.resize(abscoords.rows(), abscoords.cols());
-            closestLandmarks.resize(abscoords.cols());
+            
+            LandmarkIndex index(s);
+            index.closestLandmarks(abscoords, closestLandmarks);
             
             const int numLocs = static_cast<int>(abscoords.cols());
             for (int i  = 0; i < numLocs; ++i) {
-                int idx = findClosestLandmarkIndex(s, abscoords.col(i));
-                relcoords.col(i) = abscoords.col(i) - s.col(idx);
-                closestLandmarks(i) = idx;
+                relcoords.col(i) = abscoords.col(i) - s.col(closestLandmarks(i));
             }
             
         }
@@ -11,6 +11,7 @@
 #include <dest/core/tester.h>
 #include <dest/util/log.h>
 #include <numeric>
+#include <algorithm>
 
 
 namespace dest {
@@ -20,7 +21,7 @@ namespace dest {
         :_c(c)
         {}
         
-        float ConstantDistanceNormalizer::operator()(const SampleData::Sample &s) const {
+        float ConstantDistanceNormalizer::operator()(const Shape &target) const {
             return _c;
         }
         
@@ -32,8 +33,8 @@ namespace dest {
         :_l0(0), _l1(0)
         {}
         
-        float LandmarkDistanceNormalizer::operator()(const SampleData::Sample &s) const {
-            return 1.f / (s.target.col(_l0) - s.target.col(_l1)).norm();
+        float LandmarkDistanceNormalizer::operator()(const Shape &target) const {
+            return 1.f / (target.col(_l0) - target.col(_l1)).norm();
         }
         
         LandmarkDistanceNormalizer LandmarkDistanceNormalizer::createInterocularNormalizerIBug() {
@@ -58,15 +59,15 @@ namespace dest {
             r.stddevNormalizedDistance = 0.f;
             r.worstNormalizedDistance = 0.f;
             
-            const int nLandmarks = static_cast<int>(td.samples.front().target.cols());
+            const int nLandmarks = static_cast<int>(td.target(0).cols());
             std::vector<float> d;
             
-            for (size_t i = 0; i < td.samples.size(); ++i) {
+            for (int i = 0; i < td.numSamples(); ++i) {
                 
-                dest::core::Shape estimateInImageSpace = t.predict(td.input->images[td.samples[i].inputIdx], td.samples[i].shapeToImage);
-                td.samples[i].estimate = td.samples[i].shapeToImage.inverse() * estimateInImageSpace.colwise().homogeneous();
+                dest::core::Shape estimateInImageSpace = t.predict(td.image(i), td.shapeToImage(i));
+                td.estimate(i) = td.shapeToImage(i).inverse() * estimateInImageSpace.colwise().homogeneous();
                 
-                const float normalizer = norm(td.samples[i]);
+                const float normalizer = norm(td.target(i));
 
 
 				typedef Eigen::Matrix<float, 2, Eigen::Dynamic> Shape2f;
@@ -78,17 +79,17 @@ namespace dest {
 				Target.resize(2, 68);
 				Estimate.resize(2, 68);
 				for (int m = 0; m < 68; m++) {
-					Target(0, m) = td.samples[i].target(0,m);
-					Estimate(0, m) = td.samples[i].estimate(0, m);
+					Target(0, m) = td.target(i)(0,m);
+					Estimate(0, m) = td.estimate(i)(0, m);
 
-					Target(1, m) = td.samples[i].target(1, m);
-					Estimate(1, m) = td.samples[i].estimate(1, m);
+					Target(1, m) = td.target(i)(1, m);
+					Estimate(1, m) = td.estimate(i)(1, m);
 				}
 
 				Eigen::VectorXf dev = (Target - Estimate).colwise().norm() * normalizer;
 				
 
-				//Eigen::VectorXf dev = (td.samples[i].target - td.samples[i].estimate).colwise().norm() * normalizer;
+				//Eigen::VectorXf dev = (td.target(i) - td.estimate(i)).colwise().norm() * normalizer;
                 for (int j  = 0; j < nLandmarks; ++j) {
                     if (dev(j) > 1.9f)
 						DEST_LOG(i);
@@ -96,7 +97,7 @@ namespace dest {
                 }
             
                 if (i % 100 == 0)
-					DEST_LOG("Processing " << i << "/" << td.samples.size() << " elements.\r" << std::flush);
+					DEST_LOG("Processing " << i << "/" << td.numSamples() << " elements.\r" << std::flush);
             }
             
             std::sort(d.begin(), d.end());
@@ -127,5 +128,60 @@ namespace dest {
             return r;
         }
         
+        PruneParameters::PruneParameters()
+        {
+            maxErrorIncrease = 0.001f;
+            groupSize = 10;
+            trailingOnly = false;
+        }
+        
+        inline int countTrees(const Tracker &t) {
+            int n = 0;
+            for (int c = 0; c < t.numCascades(); ++c) {
+                n += t.numTrees(c);
+            }
+            return n;
+        }
+        
+        PruneResult pruneTracker(SampleData &td, Tracker &t, const DistanceNormalizer &norm, const PruneParameters &params) {
+            PruneResult r;
+            r.numTreesBefore = countTrees(t);
+            r.before = testTracker(td, t, norm);
+            
+            const float maxError = r.before.meanNormalizedDistance + params.maxErrorIncrease;
+            const int groupSize = std::max<int>(params.groupSize, 1);
+            float currentError = r.before.meanNormalizedDistance;
+            
+            for (int c = t.numCascades() - 1; c >= 0; --c) {
+                const int numGroups = (t.numTrees(c) + groupSize - 1) / groupSize;
+                
+                for (int g = numGroups - 1; g >= 0; --g) {
+                    // Groups are visited back to front, so indices of earlier groups remain valid.
+                    std::vector<int> ids;
+                    for (int i = g * groupSize; i < std::min<int>((g + 1) * groupSize, t.numTrees(c)); ++i) {
+                        ids.push_back(i);
+                    }
+                    
+                    Tracker candidate(t);
+                    candidate.removeTrees(c, ids);
+                    const float e = testTracker(td, candidate, norm).meanNormalizedDistance;
+                    
+                    DEST_LOG("Cascade " << c << ", trees " << ids.front() << "-" << ids.back() << ": marginal contribution " << (e - currentError) << std::endl);
+                    
+                    if (e <= maxError) {
+                        t.removeTrees(c, ids);
+                        currentError = e;
+                    } else if (params.trailingOnly) {
+                        break;
+                    }
+                }
+            }
+            
+            r.numTreesAfter = countTrees(t);
+            r.after = testTracker(td, t, norm);
+            
+            return r;
+        }
+        
     }
 }
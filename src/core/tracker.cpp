@@ -121,98 +121,38 @@ namespace dest {
 		//ĵѵ뾹Ȼֻôһ
         bool Tracker::fit(SampleData &t) {
 			
-            eigen_assert(!t.samples.empty());
+            eigen_assert(t.numSamples() > 0);
             
-			DEST_LOG("Starting to fit tracker on " << t.samples.size() << " samples.");
+			DEST_LOG("Starting to fit tracker on " << t.numSamples() << " samples.");
 			DEST_LOG(t.params);
 
             Tracker::data &data = *_data;
-            
-            const int numSamples = static_cast<int>(t.samples.size());
 
             RegressorTraining rt;
             rt.training = &t;
-            rt.numLandmarks = static_cast<int>(t.samples.front().estimate.cols());
+            rt.numLandmarks = t.numLandmarks();
             rt.input = t.input;
+            rt.randomSeed = static_cast<unsigned int>(t.input->rnd());
             
             
             // Re-eval mean shape here.
-            rt.meanShape = Shape::Zero(3, rt.numLandmarks);
-			Shape temp_1 = Shape::Zero(3, rt.numLandmarks);
-			Shape temp_2 = Shape::Zero(3, rt.numLandmarks);
-			Shape temp_3 = Shape::Zero(3, rt.numLandmarks);
-
-			//Ӵ޶
-			if (numSamples < 50000) {
-				for (int i = 0; i < numSamples; ++i) {
-					rt.meanShape += t.samples[i].estimate;
-				}
-				rt.meanShape /= static_cast<float>(numSamples);
-			}
-			else if (numSamples < 100000) {
-				for (int i = 0; i < 50000; ++i) {
-					temp_1 += t.samples[i].estimate;
-				}
-				temp_1 /= static_cast<float>(50000);
-
-				for (int i = 50000; i < numSamples; ++i) {
-					temp_2 += t.samples[i].estimate;
-				}
-				temp_2 /= static_cast<float>(numSamples - 50000);
-				float weight = static_cast<float>(50000) / static_cast<float>(numSamples);
-
-				rt.meanShape = temp_1*weight + temp_2*(1 - weight);
-			}
-			else if (numSamples < 150000) {
-				for (int i = 0; i < 50000; ++i) {
-					temp_1 += t.samples[i].estimate;
-				}
-				temp_1 /= static_cast<float>(50000);
-
-				for (int i = 50000; i < 100000; ++i) {
-					temp_2 += t.samples[i].estimate;
-				}
-				temp_2 /= static_cast<float>(50000);
-
-				for (int i = 100000; i < numSamples; ++i) {
-					temp_3 += t.samples[i].estimate;
-				}
-				temp_3 /= static_cast<float>(numSamples - 50000);
-				float weight = static_cast<float>(50000) / static_cast<float>(numSamples);
-
-				rt.meanShape = temp_1*weight + temp_2*weight + temp_3*(1-weight-weight);
-
-			}
-			else
-				DEST_LOG("Too many samples, help yourself to dest::tracker.cpp");
-			/*
-            for (int i = 0; i < numSamples; ++i) {
-                rt.meanShape += t.samples[i].estimate;
-            }
-            rt.meanShape /= static_cast<float>(numSamples);
-            */
+            rt.meanShape = computeMeanShape(t);
+            
             // Build cascade
             data.cascade.resize(t.params.numCascades);
             
             for (int i = 0; i < t.params.numCascades; ++i) {
 				DEST_LOG("Building cascade ");
                 
-                // Fit gradient boosted trees.
+                // Fit gradient boosted trees, updates shape estimates.
+                rt.cascade = i;
                 data.cascade[i].fit(rt);
-                
-                // Update shape estimate
-                for (int s = 0; s < numSamples; ++s) {
-                    t.samples[s].estimate +=
-                        data.cascade[i].predict(t.input->images[t.samples[s].inputIdx],
-                                                t.samples[s].estimate,
-                                                t.samples[s].shapeToImage);
-                }
             }
 			
             // Update internal data
             data.meanShape = rt.meanShape;
 			Rect shape_bounds = shapeBounds(data.meanShape);
-			data.meanShapeRectCorners.resize(3, 4);
+			data.meanShapeRectCorners.setZero(3, 4);
 			data.meanShapeRectCorners(0, 0) = shape_bounds(0, 0);
 			data.meanShapeRectCorners(0, 1) = shape_bounds(0, 1);
 			data.meanShapeRectCorners(0, 2) = shape_bounds(0, 2);
@@ -226,6 +166,46 @@ namespace dest {
 
         }
         
+        void Tracker::quantizeLeaves(int codebookSize, std::mt19937 &rnd)
+        {
+            Tracker::data &data = *_data;
+            
+            for (size_t i = 0; i < data.cascade.size(); ++i) {
+                data.cascade[i].quantizeLeaves(codebookSize, rnd);
+            }
+        }
+        
+        int Tracker::numCascades() const
+        {
+            return static_cast<int>(_data->cascade.size());
+        }
+        
+        int Tracker::numTrees(int cascade) const
+        {
+            return _data->cascade[cascade].numTrees();
+        }
+        
+        void Tracker::removeTrees(int cascade, const std::vector<int> &treeIds)
+        {
+            _data->cascade[cascade].removeTrees(treeIds);
+        }
+        
+        Eigen::VectorXi Tracker::pixelUsage(int cascade) const
+        {
+            return _data->cascade[cascade].pixelUsage();
+        }
+        
+        int Tracker::removeUnusedPixels()
+        {
+            Tracker::data &data = *_data;
+            
+            int numRemoved = 0;
+            for (size_t i = 0; i < data.cascade.size(); ++i) {
+                numRemoved += data.cascade[i].removeUnusedPixels();
+            }
+            return numRemoved;
+        }
+        
         Shape Tracker::predict(const Image &img, const ShapeTransform &shapeToImage, std::vector<Shape> *stepResults) const
         {
 
@@ -9,7 +9,11 @@
 */
 
 #include <dest/core/training_data.h>
+#include <dest/core/config.h>
 #include <iomanip>
+#include <algorithm>
+#include <limits>
+#include <cmath>
 #include <dest/util/log.h>
 
 namespace dest {
@@ -25,6 +29,10 @@ namespace dest {
             exponentialLambda = 0.1f;
             learningRate = 0.05f;
             expansionRandomPixelCoordinates = 0.05f;
+            numResidualBasisVectors = 0;
+            numSplitHistogramBins = 0;
+            sampleFractionPerTree = 1.f;
+            pixelFractionPerTree = 1.f;
         }
         
         std::ostream& operator<<(std::ostream &stream, const TrainingParameters &obj) {
@@ -35,7 +43,12 @@ namespace dest {
                    << std::setw(30) << std::left << "Random split tests" << std::setw(10) << obj.numRandomSplitTestsPerNode << std::endl
                    << std::setw(30) << std::left << "Random pixel expansion" << std::setw(10) << obj.expansionRandomPixelCoordinates << std::endl
                    << std::setw(30) << std::left << "Exponential lambda" << std::setw(10) << obj.exponentialLambda << std::endl
-                   << std::setw(30) << std::left << "Learning rate" << std::setw(10) << obj.learningRate;
+                   << std::setw(30) << std::left << "Learning rate" << std::setw(10) << obj.learningRate << std::endl
+                   << std::setw(30) << std::left << "Residual basis vectors" << std::setw(10) << obj.numResidualBasisVectors << std::endl
+                   << std::setw(30) << std::left << "Split histogram bins" << std::setw(10) << obj.numSplitHistogramBins << std::endl
+                   << std::setw(30) << std::left << "Sample fraction per tree" << std::setw(10) << obj.sampleFractionPerTree << std::endl
+                   << std::setw(30) << std::left << "Pixel fraction per tree" << std::setw(10) << obj.pixelFractionPerTree << std::endl
+                   << std::setw(30) << std::left << "Sample store" << std::setw(10) << (obj.sampleStoreDirectory.empty() ? std::string("memory") : obj.sampleStoreDirectory);
             return stream;
         }
         
@@ -99,6 +112,45 @@ namespace dest {
 				ShapeTransform t = estimateSimilarityTransform(input_rect_to_Shape, unit_rect_to_shape);
                 input.shapes[i] = t * input.shapes[i].colwise().homogeneous();
                 input.shapeToImage[i] = t.inverse();
+
+                if (input.isMirrored(i)) {
+                    // Map mirrored coordinates x' = (w - 1) - x back to the original image
+                    ShapeTransform m = ShapeTransform::Identity();
+                    m.linear()(0, 0) = -1.f;
+                    m.translation()(0) = static_cast<float>(input.image(i).cols() - 1);
+                    input.shapeToImage[i] = m * input.shapeToImage[i];
+                }
+            }
+        }
+
+        /**
+            Append the shapes ids[first..last) of src to dst. Images referenced by several of
+            the selected shapes are copied only once.
+        */
+        static void appendShapes(const InputData &src, const std::vector<int> &ids, size_t first, size_t last, InputData &dst)
+        {
+            const bool sharedImages = !src.imageIds.empty();
+            std::vector<int> newImageIds(sharedImages ? src.images.size() : 0, -1);
+
+            for (size_t i = first; i < last; ++i) {
+                const int id = ids[i];
+                dst.shapes.push_back(src.shapes[id]);
+                dst.shapeToImage.push_back(src.shapeToImage[id]);
+                dst.rects.push_back(src.rects[id]);
+
+                if (!src.mirrored.empty())
+                    dst.mirrored.push_back(src.mirrored[id]);
+
+                if (sharedImages) {
+                    int &newId = newImageIds[src.imageIds[id]];
+                    if (newId < 0) {
+                        newId = static_cast<int>(dst.images.size());
+                        dst.images.push_back(src.images[src.imageIds[id]]);
+                    }
+                    dst.imageIds.push_back(newId);
+                } else {
+                    dst.images.push_back(src.images[id]);
+                }
             }
         }
         
@@ -113,55 +165,249 @@ namespace dest {
             validate.shapes.clear();
             validate.shapeToImage.clear();
             validate.images.clear();
+            validate.imageIds.clear();
+            validate.mirrored.clear();
             validate.rects.clear();
             
-            for (size_t i = 0; i < numValidate; ++i) {
-                validate.shapes.push_back(train.shapes[ids[i]]);
-                validate.shapeToImage.push_back(train.shapeToImage[ids[i]]);
-                validate.images.push_back(train.images[ids[i]]);
-                validate.rects.push_back(train.rects[ids[i]]);
-            }
+            appendShapes(train, ids, 0, numValidate, validate);
             
             InputData train2;
-            for (size_t i = numValidate; i < ids.size(); ++i)
-            {
-                train2.shapes.push_back(train.shapes[ids[i]]);
-                train2.shapeToImage.push_back(train.shapeToImage[ids[i]]);
-                train2.images.push_back(train.images[ids[i]]);
-                train2.rects.push_back(train.rects[ids[i]]);
-            }
+            appendShapes(train, ids, numValidate, ids.size(), train2);
             
             std::swap(train2, train);
         }
 
         SampleData::SampleData(InputData &input_)
-        : input(&input_)
+        : input(&input_), estimates(0, 0, 0)
         {}
         
         Shape computeMeanShape(const SampleData &td)
         {
-            const int numSamples = static_cast<int>(td.samples.size());
-            const int numLandmarks = static_cast<int>(td.samples.front().estimate.cols());
+            const int numSamples = td.numSamples();
+            if (numSamples == 0) {
+                return Shape();
+            }
             
-            Shape meanShape = Shape::Zero(3, numLandmarks);
-            for (int i = 0; i < numSamples; ++i) {
-                meanShape += td.samples[i].estimate;
+            const int numLandmarks = td.numLandmarks();
+            
+            // Sum fixed size blocks of samples in double precision
+            const int blockSize = 4096;
+            const int numBlocks = (numSamples + blockSize - 1) / blockSize;
+            std::vector<Eigen::VectorXd> sums(numBlocks);
+            
+#ifdef DEST_WITH_OPENMP
+            #pragma omp parallel for schedule(static)
+#endif
+            for (int b = 0; b < numBlocks; ++b) {
+                const int first = b * blockSize;
+                const int last = std::min<int>(first + blockSize, numSamples);
+                sums[b] = td.estimates.middleCols(first, last - first).cast<double>().rowwise().sum();
             }
-            meanShape /= static_cast<float>(numSamples);
-            return meanShape;
+            
+            // Reduce block sums pairwise in a fixed order, so the result does not depend on
+            // the number of threads and rounding errors grow only logarithmically.
+            for (int step = 1; step < numBlocks; step *= 2) {
+                for (int b = 0; b + step < numBlocks; b += 2 * step) {
+                    sums[b] += sums[b + step];
+                }
+            }
+            
+            const Eigen::VectorXf mean = (sums[0] / static_cast<double>(numSamples)).cast<float>();
+            return Eigen::Map<const Shape>(mean.data(), 3, numLandmarks);
+        }
+        
+        /** Allocate rows * cols values in memory or in a mapped file of the given directory. */
+        static float *allocateValues(SampleStorage &s, int rows, int cols, const std::string &directory)
+        {
+            const size_t count = static_cast<size_t>(rows) * static_cast<size_t>(cols);
+            
+            s.file.close();
+            if (!directory.empty() && s.file.create(directory, count * sizeof(float))) {
+                std::vector<float>().swap(s.memory);
+                return static_cast<float*>(s.file.memory());
+            } else {
+                s.memory.resize(count);
+                return s.memory.empty() ? 0 : &s.memory[0];
+            }
+        }
+        
+        void SampleStorage::allocate(SampleMatrixMap &m, int rows, int cols, const std::string &directory)
+        {
+            float *ptr = allocateValues(*this, rows, cols, directory);
+            
+            // Rebinding a map requires placement new, see Eigen's documentation of Map
+            new (&m) SampleMatrixMap(ptr, rows, cols);
+        }
+        
+        void SampleStorage::allocate(Eigen::Map<Eigen::MatrixXf> &m, int rows, int cols, const std::string &directory)
+        {
+            float *ptr = allocateValues(*this, rows, cols, directory);
+            new (&m) Eigen::Map<Eigen::MatrixXf>(ptr, rows, cols);
+        }
+        
+        TreeTraining::TreeTraining()
+        : intensities(0, 0, 0), residuals(0, 0, 0), nodeIntensities(0, 0, 0), nodeResiduals(0, 0, 0)
+        {}
+        
+        std::mt19937 createRandomStream(unsigned int seed, int key0, int key1, int key2)
+        {
+            std::seed_seq seq = {
+                seed,
+                static_cast<unsigned int>(key0),
+                static_cast<unsigned int>(key1),
+                static_cast<unsigned int>(key2)
+            };
+            return std::mt19937(seq);
+        }
+        
+        PixelPairDistribution::PixelPairDistribution()
+        : numPixels(0), numSubsetPixels(0)
+        {}
+        
+        void PixelPairDistribution::create(const PixelCoordinates &coords, float lambda)
+        {
+            numPixels = static_cast<int>(coords.cols());
+            setSubset(std::vector<int>());
+            
+            const int numPairs = numPixels * numPixels;
+            probabilities.assign(numPairs, 0.f);
+            aliases.assign(numPairs, 0);
+            
+            if (numPixels < 2) {
+                return;
+            }
+            
+            // Weights relative to the closest pair avoid underflow for small lambdas
+            Eigen::MatrixXd dists(numPixels, numPixels);
+            double minDist = std::numeric_limits<double>::max();
+            for (int j = 0; j < numPixels; ++j) {
+                for (int i = 0; i < numPixels; ++i) {
+                    dists(i, j) = (coords.col(i) - coords.col(j)).norm();
+                    if (i != j) {
+                        minDist = std::min<double>(minDist, dists(i, j));
+                    }
+                }
+            }
+            
+            const double invlambda = 1.0 / lambda;
+            std::vector<double> weights(numPairs, 0.0);
+            double sumWeights = 0.0;
+            int maxPair = 1;
+            for (int k = 0; k < numPairs; ++k) {
+                const int i = k / numPixels;
+                const int j = k % numPixels;
+                if (i != j) {
+                    weights[k] = std::exp(-(dists(i, j) - minDist) * invlambda);
+                    sumWeights += weights[k];
+                    if (weights[k] > weights[maxPair]) {
+                        maxPair = k;
+                    }
+                }
+            }
+            
+            // Vose's alias method. Scaled weights below one are topped up by an alias above one.
+            std::vector<int> small, large;
+            for (int k = 0; k < numPairs; ++k) {
+                weights[k] *= numPairs / sumWeights;
+                if (weights[k] < 1.0) {
+                    small.push_back(k);
+                } else {
+                    large.push_back(k);
+                }
+            }
+            
+            while (!small.empty() && !large.empty()) {
+                const int s = small.back(); small.pop_back();
+                const int l = large.back(); large.pop_back();
+                
+                probabilities[s] = static_cast<float>(weights[s]);
+                aliases[s] = l;
+                
+                weights[l] -= 1.0 - weights[s];
+                if (weights[l] < 1.0) {
+                    small.push_back(l);
+                } else {
+                    large.push_back(l);
+                }
+            }
+            
+            // Remaining pairs are left due to rounding errors. Keep them, except for pairs of
+            // identical pixels which are redirected to the most probable pair.
+            small.insert(small.end(), large.begin(), large.end());
+            for (size_t k = 0; k < small.size(); ++k) {
+                const bool keep = weights[small[k]] > 0.0;
+                probabilities[small[k]] = keep ? 1.f : 0.f;
+                aliases[small[k]] = keep ? small[k] : maxPair;
+            }
+        }
+        
+        void PixelPairDistribution::setSubset(const std::vector<int> &pixelIds)
+        {
+            numSubsetPixels = static_cast<int>(pixelIds.size());
+            subsetIndex.clear();
+            
+            if (!pixelIds.empty()) {
+                subsetIndex.assign(numPixels, -1);
+                for (int j = 0; j < numSubsetPixels; ++j) {
+                    subsetIndex[pixelIds[j]] = j;
+                }
+            }
+        }
+        
+        /** Maximum number of rejected draws before falling back to uniformly drawn subset pairs. */
+        static const int maxPairRejections = 10000;
+        
+        bool PixelPairDistribution::sample(std::mt19937 &rnd, int &idx1, int &idx2) const
+        {
+            const int numDrawPixels = subsetIndex.empty() ? numPixels : numSubsetPixels;
+            if (numDrawPixels < 2) {
+                return false;
+            }
+            
+            std::uniform_int_distribution<int> di(0, numPixels * numPixels - 1);
+            std::uniform_real_distribution<float> drZeroOne(0.f, 1.f);
+            
+            for (int attempt = 0; attempt < maxPairRejections; ++attempt) {
+                int k = di(rnd);
+                if (drZeroOne(rnd) >= probabilities[k]) {
+                    k = aliases[k];
+                }
+                
+                idx1 = k / numPixels;
+                idx2 = k % numPixels;
+                if (subsetIndex.empty()) {
+                    return true;
+                }
+                
+                // Keep pairs within the subset only, which preserves their relative probabilities
+                idx1 = subsetIndex[idx1];
+                idx2 = subsetIndex[idx2];
+                if (idx1 >= 0 && idx2 >= 0) {
+                    return true;
+                }
+            }
+            
+            std::uniform_int_distribution<int> ds(0, numDrawPixels - 1);
+            idx1 = ds(rnd);
+            do {
+                idx2 = ds(rnd);
+            } while (idx2 == idx1);
+            return true;
         }
         
         void SampleData::createTestingSamples(SampleData &td) {
             const int numSamples = static_cast<int>(td.input->shapes.size());
-            td.samples.resize(numSamples);
+            const int numLandmarks = numSamples > 0 ? static_cast<int>(td.input->shapes.front().cols()) : 0;
             
+            td.inputIds.resize(numSamples);
             for (int i = 0; i < numSamples; ++i) {
-                td.samples[i].inputIdx = i;
-                td.samples[i].target = td.input->shapes[i];
-                td.samples[i].shapeToImage = td.input->shapeToImage[i];
-                // Note, estimate is not set by this method as it is not used during testing.
+                td.inputIds[i] = i;
             }
             
+            // Note, estimates are not initialized by this method as they are not used during testing.
+            td.estimateStorage.allocate(td.estimates, 3 * numLandmarks, numSamples, td.params.sampleStoreDirectory);
+            td.estimates.setZero();
+            
             td.meanShape = computeMeanShape(td);
         }
         
@@ -176,36 +422,39 @@ namespace dest {
 			DEST_LOG(validatedParams);
             
             const int numShapes = static_cast<int>(td.input->shapes.size());
+            const int numLandmarks = numShapes > 0 ? static_cast<int>(td.input->shapes.front().cols()) : 0;
             int numSamples = numShapes * validatedParams.numShapesPerImage;
             
-            std::uniform_int_distribution<int> dist(0, numShapes - 1);
-            std::uniform_real_distribution<float> zeroone(params.linearWeightRange.first, params.linearWeightRange.second);
+            // Each sample draws from its own stream, samples are independent of each other
+            const unsigned int seed = static_cast<unsigned int>(td.input->rnd());
+            
+            // Allocate final size up front, mapped storage cannot grow in place
+            const int numTotalSamples = numSamples + (validatedParams.includeMeanShape ? numShapes : 0);
+            td.inputIds.resize(numSamples);
+            td.estimateStorage.allocate(td.estimates, 3 * numLandmarks, numTotalSamples, td.params.sampleStoreDirectory);
             
-            td.samples.resize(numSamples);
+#ifdef DEST_WITH_OPENMP
+            #pragma omp parallel for schedule(static)
+#endif
             for (int i = 0; i < numSamples; ++i) {
+                std::mt19937 rnd = createRandomStream(seed, i);
+                std::uniform_int_distribution<int> dist(0, numShapes - 1);
+                std::uniform_real_distribution<float> zeroone(params.linearWeightRange.first, params.linearWeightRange.second);
                 
-                int idx = i % numShapes;
-                td.samples[i].inputIdx = idx;
-                td.samples[i].target = td.input->shapes[idx];
-                td.samples[i].shapeToImage = td.input->shapeToImage[idx];
+                td.inputIds[i] = i % numShapes;
                 
-                float w = zeroone(td.input->rnd);
-                td.samples[i].estimate = td.input->shapes[dist(td.input->rnd)] * w +
-                                         td.input->shapes[dist(td.input->rnd)] * (1.f - w);
+                float w = zeroone(rnd);
+                td.estimate(i) = td.input->shapes[dist(rnd)] * w +
+                                 td.input->shapes[dist(rnd)] * (1.f - w);
             }
             td.meanShape = computeMeanShape(td);
             
             if (validatedParams.includeMeanShape) {
+                td.inputIds.resize(numTotalSamples);
+                
                 for (int i = 0; i < numShapes; ++i) {
-                    SampleData::Sample s;
-                    
-                    s.inputIdx = i;
-                    s.target = td.input->shapes[i];
-                    s.shapeToImage = td.input->shapeToImage[i];
-                    s.estimate = td.meanShape;
-                    
-                    td.samples.push_back(s);
-
+                    td.inputIds[numSamples + i] = i;
+                    td.estimate(numSamples + i) = td.meanShape;
                 }
             }
         }
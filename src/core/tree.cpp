@@ -12,6 +12,8 @@
 #include <dest/core/config.h>
 #include <dest/util/log.h>
 #include <dest/io/matrix_io.h>
+#include <algorithm>
+#include <limits>
 #include <queue>
 
 namespace dest {
@@ -27,22 +29,42 @@ namespace dest {
             // For intermediate nodes
             Tree::SplitInfo split;
             // For leaf nodes
-            ShapeResidual mean;
+            Eigen::VectorXf mean;
+            // For quantized leaf nodes
+            int code;
+            
+            TreeNode()
+            : code(-1)
+            {
+                split.idx1 = -1;
+                split.idx2 = -1;
+                split.threshold = 0.f;
+            }
             
             flatbuffers::Offset<io::TreeNode> save(flatbuffers::FlatBufferBuilder &fbb) const {
-                flatbuffers::Offset<io::MatrixF> lmean = io::toFbs(fbb, mean);
-                return io::CreateTreeNode(fbb, split.idx1, split.idx2, split.threshold, lmean);
+                flatbuffers::Offset<io::MatrixF> lmean = 0;
+                if (mean.size() > 0) {
+                    lmean = io::toFbs(fbb, mean);
+                }
+                return io::CreateTreeNode(fbb, split.idx1, split.idx2, split.threshold, lmean, code);
             }
             
             void load(const io::TreeNode &fbs) {
                 split.idx1 = fbs.idx1();
                 split.idx2 = fbs.idx2();
                 split.threshold = fbs.threshold();
-                io::fromFbs(*fbs.mean(), mean);
+                code = fbs.code();
+                if (fbs.mean()) {
+                    // Stored as flattened vector or, in older versions, as 3xN shape residual.
+                    mean = Eigen::Map<const Eigen::VectorXf>(fbs.mean()->data()->data(), fbs.mean()->data()->size());
+                } else {
+                    mean.resize(0);
+                }
             }
         };
         
-        typedef std::pair<TreeTraining::SampleVector::iterator, TreeTraining::SampleVector::iterator> SampleRange;
+        /** Range of positions in TreeTraining::sampleIds. */
+        typedef std::pair<int, int> SampleRange;
         
         
         struct Tree::NodeInfo {
@@ -53,53 +75,95 @@ namespace dest {
             NodeInfo() {}
             
             NodeInfo(int n, int d, const SampleRange &r)
-            :node(n), depth(d)
-            {
-                range.first = r.first;
-                range.second = r.second;
-            }
-
-            NodeInfo(const NodeInfo &other)
-                :node(other.node), depth(other.depth)
-            {
-                range.first = other.range.first;
-                range.second = other.range.second;
-            }
+            :node(n), depth(d), range(r)
+            {}
         };
         
         inline int numElementsInRange(const SampleRange &r) {
-            return static_cast<int>(std::distance(r.first, r.second));
+            return r.second - r.first;
+        }
+        
+        /** Number of samples per block when evaluating splits in parallel across samples. */
+        static const int sampleBlockSize = 1024;
+        
+        /**
+            Whether a node is large enough to evaluate its splits in parallel across sample blocks
+            rather than across split candidates.
+        */
+        inline bool splitInBlocks(int numElements, int numSplits) {
+            const int numBlocks = (numElements + sampleBlockSize - 1) / sampleBlockSize;
+            return numBlocks >= std::max<int>(numSplits, 2);
         }
         
-        inline ShapeResidual meanResidualOfRange(const SampleRange &r, int numLandmarks) {
-            ShapeResidual mean = ShapeResidual::Zero(3, numLandmarks);
+        /** Split thresholds are chosen from [-maxSplitThreshold, maxSplitThreshold]. */
+        static const float maxSplitThreshold = 64.f;
+        
+        inline float splitEnergyOfMeans(const Eigen::VectorXf &parentMean, float numParent, const Eigen::VectorXf &leftMean, int numLeftElements) {
+            const float numLeft = static_cast<float>(numLeftElements);
+            const float numRight = numParent - numLeft;
+            
+            Eigen::VectorXf rRight = (numParent * parentMean - numLeft * leftMean) / numRight;
+            
+            return numLeftElements * leftMean.squaredNorm() + numRight * rRight.squaredNorm();
+        }
+        
+        inline Eigen::VectorXf meanResidualOfRange(const TreeTraining &t, const SampleRange &r) {
+            Eigen::VectorXf mean = Eigen::VectorXf::Zero(t.residualDims);
             
             const int numElements = numElementsInRange(r);
             if (numElements > 0) {
-                for (TreeTraining::SampleVector::iterator i = r.first; i != r.second; ++i) {
-                    mean += i->residual;
+                for (int i = r.first; i != r.second; ++i) {
+                    mean += t.nodeResiduals.row(i).transpose();
                 }
                 mean /= static_cast<float>(numElements);
             }
             return mean;
         }
         
-        template<class UnaryPredicate>
-        inline std::pair<ShapeResidual, int> meanResidualOfRangeIf(const SampleRange &r, int numLandmarks, UnaryPredicate pred) {
-            ShapeResidual mean = ShapeResidual::Zero(3, numLandmarks);
-            
-            int numElements = 0;
-            for (TreeTraining::SampleVector::iterator i = r.first; i != r.second; ++i) {
-                if (pred(*i)) {
-                    mean += i->residual;
-                    ++numElements;
-                }
+        /** Number of samples per block when copying samples to node order. */
+        static const int gatherBlockSize = 256;
+        
+        /**
+            Copy intensities and residuals of samples in sampleIds to node order. Sample ids
+            are sorted first, so this streams through stored samples. Intensities are transposed
+            block-wise to one row per pixel.
+        */
+        inline void gatherNodeSamples(TreeTraining &t) {
+            std::sort(t.sampleIds.begin(), t.sampleIds.end());
+            
+            const int numSamples = static_cast<int>(t.sampleIds.size());
+            const int numPixels = t.pixelIds.empty() ? static_cast<int>(t.intensities.cols()) : static_cast<int>(t.pixelIds.size());
+            const std::string &storeDirectory = t.training->params.sampleStoreDirectory;
+            
+            // Sizes are the same for all trees of a regressor, storage is reused
+            if (t.nodeIntensities.rows() != numPixels || t.nodeIntensities.cols() != numSamples) {
+                t.nodeIntensityStorage.allocate(t.nodeIntensities, numPixels, numSamples, storeDirectory);
             }
-            if (numElements > 0) {
-                mean /= static_cast<float>(numElements);
+            if (t.nodeResiduals.rows() != numSamples || t.nodeResiduals.cols() != t.residualDims) {
+                t.nodeResidualStorage.allocate(t.nodeResiduals, numSamples, t.residualDims, storeDirectory);
             }
             
-            return std::make_pair(mean, numElements);
+            const int numBlocks = (numSamples + gatherBlockSize - 1) / gatherBlockSize;
+            
+#ifdef DEST_WITH_OPENMP
+            #pragma omp parallel for schedule(static)
+#endif
+            for (int b = 0; b < numBlocks; ++b) {
+                const int first = b * gatherBlockSize;
+                const int last = std::min<int>(first + gatherBlockSize, numSamples);
+                
+                for (int s = first; s < last; ++s) {
+                    t.nodeResiduals.row(s) = t.residuals.row(t.sampleIds[s]);
+                }
+                
+                // Source rows of the block stay cached while pixel rows are written
+                for (int j = 0; j < numPixels; ++j) {
+                    const int col = t.pixelIds.empty() ? j : t.pixelIds[j];
+                    for (int s = first; s < last; ++s) {
+                        t.nodeIntensities(j, s) = t.intensities(t.sampleIds[s], col);
+                    }
+                }
+            }
         }
         
         struct Tree::data {
@@ -160,40 +224,72 @@ namespace dest {
             depth = std::max<int>(t.training->params.maxTreeDepth, 1);
             const int numNodes = (int)std::pow(2.0, depth) - 1;
             nodes.resize(numNodes);
+            
+            gatherNodeSamples(t);
 
-            // Split recursively in BFS
-            std::queue<NodeInfo> queue;
-            queue.push(NodeInfo(0, 1, std::make_pair(t.samples.begin(), t.samples.end())));
+            // Split level by level. Nodes of the same level own disjoint sample ranges and
+            // random streams, so results don't depend on the order they are split in.
+            std::vector<NodeInfo> level(1, NodeInfo(0, 1, SampleRange(0, static_cast<int>(t.sampleIds.size()))));
+            std::vector<NodeInfo> children;
+            std::vector<char> isSplit;
+            std::vector<int> smallNodes;
             
-            while (!queue.empty()) {
-                const NodeInfo nr = queue.front(); queue.pop();
+            const int numSplits = t.training->params.numRandomSplitTestsPerNode;
+            
+            while (!level.empty()) {
+                const int numLevelNodes = static_cast<int>(level.size());
+                
+                children.resize(2 * numLevelNodes);
+                isSplit.assign(numLevelNodes, 0);
+                smallNodes.clear();
                 
-                if (nr.depth < depth) {
-                    // Generate a split
-                    NodeInfo left, right;
-                    if (splitNode(t, nr, left, right)) {
-                        queue.push(left);
-                        queue.push(right);
+                // Large nodes parallelize within split evaluation and are split one after another
+                for (int i = 0; i < numLevelNodes; ++i) {
+                    const NodeInfo &nr = level[i];
+                    if (nr.depth < depth && splitInBlocks(numElementsInRange(nr.range), numSplits)) {
+                        isSplit[i] = fitNode(t, nr, children[2 * i], children[2 * i + 1]);
                     } else {
-                        makeLeaf(t, nr);
+                        smallNodes.push_back(i);
                     }
-                    
-                } else {
-                    makeLeaf(t, nr);
                 }
+                
+                // Small nodes are split concurrently
+                const int numSmallNodes = static_cast<int>(smallNodes.size());
+                
+#ifdef DEST_WITH_OPENMP
+                #pragma omp parallel for schedule(dynamic) if(numSmallNodes >= 2)
+#endif
+                for (int k = 0; k < numSmallNodes; ++k) {
+                    const int i = smallNodes[k];
+                    isSplit[i] = fitNode(t, level[i], children[2 * i], children[2 * i + 1]);
+                }
+                
+                std::vector<NodeInfo> next;
+                for (int i = 0; i < numLevelNodes; ++i) {
+                    if (isSplit[i]) {
+                        next.push_back(children[2 * i]);
+                        next.push_back(children[2 * i + 1]);
+                    }
+                }
+                level.swap(next);
             }
             
             return true;
         }
         
-        struct Tree::PartitionPredicate {
-            SplitInfo split;
-            
-            bool operator()(const TreeTraining::Sample &s) const {
-                return (s.intensities(split.idx1) - s.intensities(split.idx2)) > split.threshold;
+        void Tree::splitMask(const TreeTraining &t, const SampleRange &r, const SplitInfo &split, Eigen::Ref<Eigen::VectorXf> mask) {
+            const int numElements = numElementsInRange(r);
+            mask = ((t.nodeIntensities.row(split.idx1).segment(r.first, numElements) -
+                     t.nodeIntensities.row(split.idx2).segment(r.first, numElements)).array() > split.threshold).cast<float>().transpose();
+        }
+        
+        bool Tree::fitNode(TreeTraining &t, const NodeInfo &n, NodeInfo &left, NodeInfo &right) {
+            if (n.depth < _data->depth && splitNode(t, n, left, right)) {
+                return true;
             }
-            
-        };
+            makeLeaf(t, n);
+            return false;
+        }
         
         bool Tree::splitNode(TreeTraining &t, const NodeInfo &parent, NodeInfo &left, NodeInfo &right) {
             
@@ -203,23 +299,21 @@ namespace dest {
                 return false;
             }
             
-            // Generate random split positions
+            // Generate random split positions from the stream of this node
+            std::mt19937 rnd = createRandomStream(t.randomSeed, t.cascade, t.tree, parent.node);
             std::vector<SplitInfo> splits;
-            sampleSplitPositions(t, splits);
+            sampleSplitPositions(t, rnd, splits);
 
             if (splits.empty())
                 return false;
             
-            const ShapeResidual meanResidualParent = meanResidualOfRange(parent.range, t.numLandmarks);
+            const Eigen::VectorXf meanResidualParent = meanResidualOfRange(t, parent.range);
 
-            const int numSplits = static_cast<int>(splits.size());
-            std::vector<float> energies(splits.size());
-            
-#ifdef DEST_WITH_OPENMP
-            #pragma omp parallel for schedule(static)
-#endif
-            for (int i = 0; i < numSplits; ++i) {
-                energies[i] = splitEnergy(t, parent, meanResidualParent, splits[i]);
+            std::vector<float> energies;
+            if (t.training->params.numSplitHistogramBins > 0) {
+                splitEnergiesHistogram(t, parent, meanResidualParent, splits, energies);
+            } else {
+                splitEnergies(t, parent, meanResidualParent, splits, energies);
             }
 
 			//Свѡѵķѽڵ
@@ -230,9 +324,42 @@ namespace dest {
             TreeNode &parentNode = _data->nodes[parent.node];
             parentNode.split = splits[bestSplit];
             
-            PartitionPredicate pred;
-            pred.split = splits[bestSplit];
-            TreeTraining::SampleVector::iterator middle = std::partition(parent.range.first, parent.range.second, pred);
+            // Partition node samples in place along with their sample ids. Swaps are found on the
+            // predicate mask first and then applied to ids, each pixel row and residual rows. Both
+            // cursors move sequentially, so this streams through stored samples as well.
+            const int first = parent.range.first;
+            Eigen::VectorXf mask(numElementsInRange(parent.range));
+            splitMask(t, parent.range, splits[bestSplit], mask);
+            
+            std::vector< std::pair<int, int> > swaps;
+            int middle = first;
+            int last = parent.range.second;
+            while (true) {
+                while (middle < last && mask(middle - first) != 0.f) {
+                    ++middle;
+                }
+                while (middle < last && mask(last - 1 - first) == 0.f) {
+                    --last;
+                }
+                if (middle >= last) {
+                    break;
+                }
+                --last;
+                swaps.push_back(std::make_pair(middle, last));
+                ++middle;
+            }
+            
+            const int numSwaps = static_cast<int>(swaps.size());
+            for (int k = 0; k < numSwaps; ++k) {
+                std::swap(t.sampleIds[swaps[k].first], t.sampleIds[swaps[k].second]);
+                t.nodeResiduals.row(swaps[k].first).swap(t.nodeResiduals.row(swaps[k].second));
+            }
+            for (int j = 0; j < t.nodeIntensities.rows(); ++j) {
+                float *row = &t.nodeIntensities(j, 0);
+                for (int k = 0; k < numSwaps; ++k) {
+                    std::swap(row[swaps[k].first], row[swaps[k].second]);
+                }
+            }
             
             if (middle == parent.range.first || middle == parent.range.second) {
 				//˵Ҫ
@@ -255,64 +382,184 @@ namespace dest {
             Tree::TreeNode &leaf = _data->nodes[ni.node];
             leaf.split.idx1 = -1;
             leaf.split.idx2 = -1;
-            leaf.mean = meanResidualOfRange(ni.range, t.numLandmarks);
+            leaf.mean = meanResidualOfRange(t, ni.range);
+            leaf.code = -1;
+            
+            for (int i = ni.range.first; i != ni.range.second; ++i) {
+                t.sampleLeaves[t.sampleIds[i]] = ni.node;
+            }
         }
         
-        void Tree::sampleSplitPositions(TreeTraining &t, std::vector<SplitInfo> &splits) const
+        void Tree::sampleSplitPositions(const TreeTraining &t, std::mt19937 &rnd, std::vector<SplitInfo> &splits) const
         {
             splits.clear();
             
-            const int maxAttempts = 100;
-            std::uniform_int_distribution<int> di(0, static_cast<int>(t.pixelCoordinates.cols()) - 1);
-            std::uniform_real_distribution<float> drZeroOne(0.f, 1.f);
-            std::uniform_real_distribution<float> drThreshold(-64.f, 64.f);
+            std::uniform_real_distribution<float> drThreshold(-maxSplitThreshold, maxSplitThreshold);
             
+            // Pixel pairs are drawn from the precomputed distance weighted distribution
             const int numTests = t.training->params.numRandomSplitTestsPerNode;
-            const float invlambda = 1.f / t.training->params.exponentialLambda;
-            
             for (int i = 0; i < numTests; ++i) {
-            
                 SplitInfo split;
-                int iter = 0;
-                float e;
-                float d;
-                float r;
-                do {
-                    split.idx1 = di(t.input->rnd);
-                    split.idx2 = di(t.input->rnd);
-                    d = (t.pixelCoordinates.col(split.idx1) - t.pixelCoordinates.col(split.idx2)).norm();
-                    // http://www.wolframalpha.com/input/?i=plot+e%5E%28-x%2F0.05%29+from+0.05+to+0.1
-                    e = std::exp(-d * invlambda);
-                    r = drZeroOne(t.input->rnd);
-                    ++iter;
+                if (!t.pixelPairs.sample(rnd, split.idx1, split.idx2)) {
+                    break;
+                }
+                split.threshold = drThreshold(rnd);
+                splits.push_back(split);
+            }
+        }
+        
+        void Tree::splitEnergies(TreeTraining &t, const NodeInfo &parent, const Eigen::VectorXf &parentMeanResidual, const std::vector<SplitInfo> &splits, std::vector<float> &energies) const {
+            
+            const int numSplits = static_cast<int>(splits.size());
+            const int numElements = numElementsInRange(parent.range);
+            const int numBlocks = (numElements + sampleBlockSize - 1) / sampleBlockSize;
+            
+            Eigen::MatrixXf sums;
+            Eigen::VectorXi counts;
+            
+            if (!splitInBlocks(numElements, numSplits)) {
+                // Few samples, parallelize across split candidates
+                leftResidualSums(t, parent.range, splits, true, sums, counts);
+            } else {
+                // Many samples, parallelize across fixed size sample blocks. Partial left sums of all
+                // candidates are reduced in block order, so results don't depend on the number of threads.
+                std::vector<Eigen::MatrixXf> blockSums(numBlocks);
+                std::vector<Eigen::VectorXi> blockCounts(numBlocks);
                 
-                } while ((iter <= maxAttempts) && (split.idx1 == split.idx2 || (r >= e)));
+#ifdef DEST_WITH_OPENMP
+                #pragma omp parallel for schedule(static)
+#endif
+                for (int b = 0; b < numBlocks; ++b) {
+                    const int first = parent.range.first + b * sampleBlockSize;
+                    const int last = parent.range.first + std::min<int>((b + 1) * sampleBlockSize, numElements);
+                    leftResidualSums(t, SampleRange(first, last), splits, false, blockSums[b], blockCounts[b]);
+                }
                 
-                if (iter <= maxAttempts) {
-                    split.threshold = drThreshold(t.input->rnd);
-                    splits.push_back(split);
+                sums = blockSums[0];
+                counts = blockCounts[0];
+                for (int b = 1; b < numBlocks; ++b) {
+                    sums += blockSums[b];
+                    counts += blockCounts[b];
                 }
             }
+            
+            energies.resize(splits.size());
+            
+            const float numParent = static_cast<float>(numElements);
+            for (int i = 0; i < numSplits; ++i) {
+                Eigen::VectorXf leftMean = sums.col(i);
+                if (counts(i) > 0) {
+                    leftMean /= static_cast<float>(counts(i));
+                }
+                energies[i] = splitEnergyOfMeans(parentMeanResidual, numParent, leftMean, counts(i));
+            }
         }
         
-        float Tree::splitEnergy(TreeTraining &t, const NodeInfo &parent, const ShapeResidual &parentMeanResidual, const SplitInfo &split) const {
-            
-            PartitionPredicate pred;
-            pred.split = split;
+        void Tree::leftResidualSums(const TreeTraining &t, const SampleRange &r, const std::vector<SplitInfo> &splits, bool parallelSplits, Eigen::MatrixXf &sums, Eigen::VectorXi &counts) const {
             
-            std::pair<ShapeResidual, int> left = meanResidualOfRangeIf(parent.range, t.numLandmarks, pred);
+            const int numSplits = static_cast<int>(splits.size());
+            const int numElements = numElementsInRange(r);
             
-            const float numLeft = static_cast<float>(left.second);
-            const float numParent = static_cast<float>(numElementsInRange(parent.range));
-            const float numRight = numParent - numLeft;
+            // Evaluate split predicates of all candidates into 0/1 masks
+            Eigen::MatrixXf masks(numElements, numSplits);
+            counts.resize(numSplits);
             
-            ShapeResidual rRight = (numParent * parentMeanResidual - numLeft * left.first) / numRight;
+#ifdef DEST_WITH_OPENMP
+            #pragma omp parallel for schedule(static) if(parallelSplits)
+#else
+            (void)parallelSplits;
+#endif
+            for (int i = 0; i < numSplits; ++i) {
+                splitMask(t, r, splits[i], masks.col(i));
+                counts(i) = static_cast<int>((masks.col(i).array() != 0.f).count());
+            }
             
-            return left.second * left.first.squaredNorm() + numRight * rRight.squaredNorm();
+            // Masked sums of all candidates in a single pass over the node's residual rows
+            sums.noalias() = t.nodeResiduals.middleRows(r.first, numElements).transpose() * masks;
         }
 
         
-        ShapeResidual Tree::predict(const PixelIntensities &intensities) const
+        void Tree::splitEnergiesHistogram(TreeTraining &t, const NodeInfo &parent, const Eigen::VectorXf &parentMeanResidual, std::vector<SplitInfo> &splits, std::vector<float> &energies) const {
+            
+            const int numSplits = static_cast<int>(splits.size());
+            const int numElements = numElementsInRange(parent.range);
+            const int numBins = std::max<int>(t.training->params.numSplitHistogramBins, 2);
+            const float numParent = static_cast<float>(numElements);
+            const int first = parent.range.first;
+            
+            energies.resize(splits.size());
+            
+#ifdef DEST_WITH_OPENMP
+            #pragma omp parallel for schedule(static)
+#endif
+            for (int i = 0; i < numSplits; ++i) {
+                SplitInfo &split = splits[i];
+                
+                // A difference is greater than boundary k exactly when its bin is >= k
+                Eigen::MatrixXf binSums = Eigen::MatrixXf::Zero(t.residualDims, numBins);
+                Eigen::VectorXi binCounts = Eigen::VectorXi::Zero(numBins);
+                
+                for (int s = 0; s < numElements; ++s) {
+                    const float d = t.nodeIntensities(split.idx1, first + s) - t.nodeIntensities(split.idx2, first + s);
+                    const int bin = splitHistogramBin(d, numBins);
+                    
+                    binSums.col(bin) += t.nodeResiduals.row(first + s).transpose();
+                    binCounts(bin) += 1;
+                }
+                
+                // Sweep boundaries from top, accumulating left child.
+                Eigen::VectorXf leftSum = Eigen::VectorXf::Zero(t.residualDims);
+                int numLeft = 0;
+                float bestEnergy = -std::numeric_limits<float>::max();
+                float bestThreshold = split.threshold;
+                
+                for (int k = numBins - 1; k > 0; --k) {
+                    leftSum += binSums.col(k);
+                    numLeft += binCounts(k);
+                    
+                    if (numLeft == 0 || numLeft == numElements)
+                        continue;
+                    
+                    const float e = splitEnergyOfMeans(parentMeanResidual, numParent, leftSum / static_cast<float>(numLeft), numLeft);
+                    if (e > bestEnergy) {
+                        bestEnergy = e;
+                        bestThreshold = splitHistogramBoundary(k, numBins);
+                    }
+                }
+                
+                split.threshold = bestThreshold;
+                energies[i] = bestEnergy;
+            }
+        }
+        
+        float splitHistogramBoundary(int k, int numBins)
+        {
+            const float binWidth = 2.f * maxSplitThreshold / numBins;
+            return -maxSplitThreshold + k * binWidth;
+        }
+        
+        int splitHistogramBin(float d, int numBins)
+        {
+            const float binWidth = 2.f * maxSplitThreshold / numBins;
+            int bin = std::min<int>(std::max<int>(static_cast<int>(std::ceil((d + maxSplitThreshold) / binWidth)) - 1, 0), numBins - 1);
+            
+            // Rounding may place differences close to a boundary into a neighbor bin. Correct
+            // using the same comparison as the split predicate.
+            while (bin < numBins - 1 && d > splitHistogramBoundary(bin + 1, numBins)) {
+                ++bin;
+            }
+            while (bin > 0 && !(d > splitHistogramBoundary(bin, numBins))) {
+                --bin;
+            }
+            return bin;
+        }
+        
+        const Eigen::VectorXf &Tree::leafResidual(int node) const
+        {
+            return _data->nodes[node].mean;
+        }
+        
+        int Tree::findLeafNode(const PixelIntensities &intensities) const
         {
             const TreeNode *nodes = &_data->nodes[0];
             
@@ -330,7 +577,90 @@ namespace dest {
                 n = left ? 2 * n + 1 : 2 * n + 2;
             }
             
-            return nodes[n].mean;
+            return n;
+        }
+        
+        const Eigen::VectorXf &Tree::predict(const PixelIntensities &intensities) const
+        {
+            return _data->nodes[findLeafNode(intensities)].mean;
+        }
+        
+        int Tree::predictCode(const PixelIntensities &intensities) const
+        {
+            return _data->nodes[findLeafNode(intensities)].code;
+        }
+        
+        void Tree::findLeafNodes(std::vector<int> &leaves, std::vector<int> *splits) const
+        {
+            const std::vector<Tree::TreeNode> &nodes = _data->nodes;
+            const int depth = _data->depth;
+            
+            // Children of premature leaves are never reached and hold no valid data.
+            std::queue< std::pair<int, int> > queue;
+            queue.push(std::make_pair(0, 1));
+            
+            while (!queue.empty()) {
+                const std::pair<int, int> n = queue.front(); queue.pop();
+                
+                if (n.second == depth || nodes[n.first].split.idx1 < 0) {
+                    leaves.push_back(n.first);
+                } else {
+                    if (splits)
+                        splits->push_back(n.first);
+                    queue.push(std::make_pair(2 * n.first + 1, n.second + 1));
+                    queue.push(std::make_pair(2 * n.first + 2, n.second + 1));
+                }
+            }
+        }
+        
+        void Tree::collectLeafResiduals(std::vector<Eigen::VectorXf> &residuals) const
+        {
+            std::vector<int> leaves;
+            findLeafNodes(leaves);
+            
+            for (size_t i = 0; i < leaves.size(); ++i) {
+                residuals.push_back(_data->nodes[leaves[i]].mean);
+            }
+        }
+        
+        void Tree::quantizeLeaves(const Eigen::MatrixXf &codebook)
+        {
+            std::vector<int> leaves;
+            findLeafNodes(leaves);
+            
+            for (size_t i = 0; i < leaves.size(); ++i) {
+                TreeNode &leaf = _data->nodes[leaves[i]];
+                
+                Eigen::MatrixXf::Index best;
+                (codebook.colwise() - leaf.mean).colwise().squaredNorm().minCoeff(&best);
+                
+                leaf.code = static_cast<int>(best);
+                leaf.mean.resize(0);
+            }
+        }
+        
+        void Tree::countPixelUsage(Eigen::VectorXi &counts) const
+        {
+            std::vector<int> leaves, splits;
+            findLeafNodes(leaves, &splits);
+            
+            for (size_t i = 0; i < splits.size(); ++i) {
+                const SplitInfo &s = _data->nodes[splits[i]].split;
+                counts(s.idx1) += 1;
+                counts(s.idx2) += 1;
+            }
+        }
+        
+        void Tree::remapPixels(const Eigen::VectorXi &newIndex)
+        {
+            std::vector<int> leaves, splits;
+            findLeafNodes(leaves, &splits);
+            
+            for (size_t i = 0; i < splits.size(); ++i) {
+                SplitInfo &s = _data->nodes[splits[i]].split;
+                s.idx1 = newIndex(s.idx1);
+                s.idx2 = newIndex(s.idx2);
+            }
         }
 
         
@@ -0,0 +1,295 @@
+/**
+    This file is part of Deformable Shape Tracking (DEST).
+
+    Copyright(C) 2015/2016 Christoph Heindl
+    All rights reserved.
+
+    This software may be modified and distributed under the terms
+    of the BSD license.See the LICENSE file for details.
+*/
+
+#include <dest/io/codegen.h>
+#include <dest/io/dest_io_generated.h>
+#include <dest/util/log.h>
+#include <ostream>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+namespace dest {
+    namespace io {
+
+        CodegenParameters::CodegenParameters()
+        {
+            namespaceName = "dest_generated";
+            functionName = "predict";
+        }
+
+        /**
+            Format float as C++ literal that round-trips exactly.
+        */
+        inline std::string floatLiteral(float v) {
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "%.9g", v);
+
+            std::string s(buf);
+            if (s.find_first_of(".eEn") == std::string::npos) {
+                s += ".";
+            }
+            return s + "f";
+        }
+
+        inline void writeFloatArray(std::ostream &os, const float *data, size_t n, const char *indent) {
+            for (size_t i = 0; i < n; ++i) {
+                if (i % 8 == 0) {
+                    os << (i > 0 ? ",\n" : "") << indent;
+                } else {
+                    os << ", ";
+                }
+                os << floatLiteral(data[i]);
+            }
+        }
+
+        inline void writeIntArray(std::ostream &os, const int *data, size_t n, const char *indent) {
+            for (size_t i = 0; i < n; ++i) {
+                if (i % 16 == 0) {
+                    os << (i > 0 ? ",\n" : "") << indent;
+                } else {
+                    os << ", ";
+                }
+                os << data[i];
+            }
+        }
+
+        inline bool isLeaf(const TreeNode &n, int depth, int maxDepth) {
+            return depth == maxDepth || n.idx1() < 0;
+        }
+
+        /**
+            Emit nested comparisons for the subtree rooted at given node. Each reachable
+            leaf returns its row in the leaf table of the cascade. For quantized trees the
+            leaf table is the codebook.
+        */
+        void writeTreeNode(std::ostream &os, const Tree &tree, int node, int depth, bool quantized, std::vector<int> &leafRows, int &nextRow, int indent) {
+            const TreeNode &n = *tree.nodes()->Get(node);
+            const std::string pad(indent * 4, ' ');
+
+            if (isLeaf(n, depth, tree.depth())) {
+                if (quantized) {
+                    os << pad << "return " << n.code() << ";\n";
+                } else {
+                    leafRows.push_back(node);
+                    os << pad << "return " << nextRow++ << ";\n";
+                }
+                return;
+            }
+
+            os << pad << "if (I[" << n.idx1() << "] - I[" << n.idx2() << "] > " << floatLiteral(n.threshold()) << ") {\n";
+            writeTreeNode(os, tree, 2 * node + 1, depth + 1, quantized, leafRows, nextRow, indent + 1);
+            os << pad << "} else {\n";
+            writeTreeNode(os, tree, 2 * node + 2, depth + 1, quantized, leafRows, nextRow, indent + 1);
+            os << pad << "}\n";
+        }
+
+        bool writeRegressor(std::ostream &os, const Regressor &r, int id, int numLandmarks) {
+            const int numResiduals = 3 * numLandmarks;
+            const int numPixels = r.pixelCoordinates()->cols();
+            const float learningRate = r.learningRate();
+            const bool quantized = r.codebook() && r.codebook()->cols() > 0;
+            const bool projected = r.residualBasis() && r.residualBasis()->cols() > 0;
+            const int leafDims = projected ? r.residualBasis()->cols() : numResiduals;
+
+            if (r.meanShapeResidual()->data()->size() != static_cast<flatbuffers::uoffset_t>(numResiduals)) {
+                DEST_LOG("Residual dimension of cascade " << id << " does not match number of landmarks." << std::endl);
+                return false;
+            }
+
+            os << "        // Cascade " << id << "\n\n";
+
+            os << "        const float c" << id << "_meanShape[" << numResiduals << "] = {\n";
+            writeFloatArray(os, r.meanShape()->data()->data(), r.meanShape()->data()->size(), "            ");
+            os << "\n        };\n\n";
+
+            os << "        const float c" << id << "_meanResidual[" << numResiduals << "] = {\n";
+            writeFloatArray(os, r.meanShapeResidual()->data()->data(), numResiduals, "            ");
+            os << "\n        };\n\n";
+
+            os << "        const float c" << id << "_pixelCoordinates[" << 3 * numPixels << "] = {\n";
+            writeFloatArray(os, r.pixelCoordinates()->data()->data(), r.pixelCoordinates()->data()->size(), "            ");
+            os << "\n        };\n\n";
+
+            os << "        const int c" << id << "_closestLandmarks[" << numPixels << "] = {\n";
+            writeIntArray(os, r.closestLandmarks()->data()->data(), r.closestLandmarks()->data()->size(), "            ");
+            os << "\n        };\n\n";
+
+            if (projected) {
+                if (r.residualBasis()->rows() != numResiduals) {
+                    DEST_LOG("Invalid residual basis in cascade " << id << "." << std::endl);
+                    return false;
+                }
+                os << "        EIGEN_ALIGN16 const float c" << id << "_basis[" << leafDims << "][" << numResiduals << "] = {\n";
+                for (int c = 0; c < leafDims; ++c) {
+                    os << "            {\n";
+                    writeFloatArray(os, r.residualBasis()->data()->data() + c * numResiduals, numResiduals, "                ");
+                    os << "\n            },\n";
+                }
+                os << "        };\n\n";
+            }
+
+            // Trees as straight-line code, collecting reachable leaves on the way
+            const flatbuffers::Vector<flatbuffers::Offset<Tree> > &forest = *r.forest();
+            std::vector< std::vector<int> > leafRows(forest.size());
+            int numLeaves = 0;
+
+            for (flatbuffers::uoffset_t t = 0; t < forest.size(); ++t) {
+                // A tree that is a single leaf reads no intensities, leave parameter unnamed
+                const Tree &tree = *forest.Get(t);
+                const bool rootIsLeaf = isLeaf(*tree.nodes()->Get(0), 1, tree.depth());
+                os << "        inline int c" << id << "_tree" << t << "(const float *" << (rootIsLeaf ? "" : "I") << ") {\n";
+                writeTreeNode(os, tree, 0, 1, quantized, leafRows[t], numLeaves, 3);
+                os << "        }\n\n";
+            }
+
+            // Leaf table, learning rate folded in
+            std::vector<float> scaled(leafDims);
+            if (quantized) {
+                const MatrixF &codebook = *r.codebook();
+                if (codebook.rows() != leafDims) {
+                    DEST_LOG("Invalid codebook in cascade " << id << "." << std::endl);
+                    return false;
+                }
+                numLeaves = codebook.cols();
+            }
+
+            os << "        EIGEN_ALIGN16 const float c" << id << "_leaves[" << std::max<int>(numLeaves, 1) << "][" << leafDims << "] = {\n";
+            for (int c = 0; quantized && c < numLeaves; ++c) {
+                for (int i = 0; i < leafDims; ++i) {
+                    scaled[i] = r.codebook()->data()->Get(c * leafDims + i) * learningRate;
+                }
+                os << "            {\n";
+                writeFloatArray(os, scaled.data(), scaled.size(), "                ");
+                os << "\n            },\n";
+            }
+            for (flatbuffers::uoffset_t t = 0; t < forest.size(); ++t) {
+                for (size_t l = 0; l < leafRows[t].size(); ++l) {
+                    const MatrixF *mean = forest.Get(t)->nodes()->Get(leafRows[t][l])->mean();
+                    if (mean->data()->size() != static_cast<flatbuffers::uoffset_t>(leafDims)) {
+                        DEST_LOG("Invalid leaf in cascade " << id << ", tree " << t << "." << std::endl);
+                        return false;
+                    }
+                    for (int i = 0; i < leafDims; ++i) {
+                        scaled[i] = mean->data()->Get(i) * learningRate;
+                    }
+                    os << "            {\n";
+                    writeFloatArray(os, scaled.data(), scaled.size(), "                ");
+                    os << "\n            },\n";
+                }
+            }
+            if (numLeaves == 0) {
+                os << "            { 0.f }\n";
+            }
+            os << "        };\n\n";
+
+            // Cascade update
+            os << "        inline void c" << id << "_update(const dest::core::Image &img, const dest::core::ShapeTransform &shapeToImage, dest::core::Shape &estimate) {\n"
+               << "            dest::core::PixelIntensities intensities;\n"
+               << "            readIntensities(img, estimate, shapeToImage, c" << id << "_meanShape, c" << id << "_pixelCoordinates, c" << id << "_closestLandmarks, " << numPixels << ", intensities);\n"
+               << (forest.size() > 0 ? "            const float *I = intensities.data();\n\n" : "\n")
+               << "            EIGEN_ALIGN16 float sr[" << numResiduals << "];\n"
+               << "            std::memcpy(sr, c" << id << "_meanResidual, sizeof(sr));\n";
+            if (projected) {
+                os << "            EIGEN_ALIGN16 float coeffs[" << leafDims << "] = { 0.f };\n";
+            }
+            const char *target = projected ? "coeffs" : "sr";
+            for (flatbuffers::uoffset_t t = 0; t < forest.size(); ++t) {
+                os << "            accumulate(" << target << ", c" << id << "_leaves[c" << id << "_tree" << t << "(I)], " << leafDims << ");\n";
+            }
+            if (projected) {
+                os << "            for (int c = 0; c < " << leafDims << "; ++c) {\n"
+                   << "                accumulate(sr, c" << id << "_basis[c], numResiduals, coeffs[c]);\n"
+                   << "            }\n";
+            }
+            os << "\n            estimate += Eigen::Map<const dest::core::Shape>(sr, 3, numLandmarks);\n"
+               << "        }\n\n";
+
+            return true;
+        }
+
+        bool generateTrackerSource(const core::Tracker &t, std::ostream &os, const CodegenParameters &opts)
+        {
+            flatbuffers::FlatBufferBuilder fbb;
+            io::FinishTrackerBuffer(fbb, t.save(fbb));
+            const io::Tracker &fbs = *io::GetTracker(fbb.GetBufferPointer());
+
+            if (!fbs.meanShape() || !fbs.cascade()) {
+                DEST_LOG("Tracker is not trained." << std::endl);
+                return false;
+            }
+
+            const int numLandmarks = fbs.meanShape()->cols();
+            const int numResiduals = 3 * numLandmarks;
+            const flatbuffers::Vector<flatbuffers::Offset<Regressor> > &cascade = *fbs.cascade();
+
+            os << "// automatically generated by dest_codegen, do not modify\n\n"
+               << "#include <dest/core/shape.h>\n"
+               << "#include <dest/core/image.h>\n"
+               << "#include <cstring>\n\n"
+               << "namespace " << opts.namespaceName << " {\n\n"
+               << "    dest::core::Shape " << opts.functionName << "(const dest::core::Image &img, const dest::core::ShapeTransform &shapeToImage);\n\n"
+               << "    namespace {\n\n"
+               << "        const int numLandmarks = " << numLandmarks << ";\n"
+               << "        const int numResiduals = " << numResiduals << ";\n\n"
+               << "        const float meanShape[" << numResiduals << "] = {\n";
+            writeFloatArray(os, fbs.meanShape()->data()->data(), fbs.meanShape()->data()->size(), "            ");
+            os << "\n        };\n\n";
+
+            os << "        inline void accumulate(float *sr, const float *leaf, int n) {\n"
+               << "            for (int i = 0; i < n; ++i) {\n"
+               << "                sr[i] += leaf[i];\n"
+               << "            }\n"
+               << "        }\n\n"
+               << "        inline void accumulate(float *sr, const float *leaf, int n, float w) {\n"
+               << "            for (int i = 0; i < n; ++i) {\n"
+               << "                sr[i] += w * leaf[i];\n"
+               << "            }\n"
+               << "        }\n\n"
+               << "        inline void readIntensities(const dest::core::Image &img,\n"
+               << "                                    const dest::core::Shape &shape,\n"
+               << "                                    const dest::core::ShapeTransform &shapeToImage,\n"
+               << "                                    const float *cascadeMeanShape,\n"
+               << "                                    const float *pixelCoordinates,\n"
+               << "                                    const int *closestLandmarks,\n"
+               << "                                    int numPixels,\n"
+               << "                                    dest::core::PixelIntensities &intensities)\n"
+               << "        {\n"
+               << "            Eigen::Map<const dest::core::Shape> ms(cascadeMeanShape, 3, numLandmarks);\n"
+               << "            Eigen::Map<const dest::core::PixelCoordinates> rel(pixelCoordinates, 3, numPixels);\n\n"
+               << "            Eigen::AffineCompact3f shapeToShape = dest::core::estimateSimilarityTransform(ms, shape);\n"
+               << "            dest::core::PixelCoordinates coords = shapeToShape.matrix().block<3,3>(0,0) * rel;\n"
+               << "            for (int i = 0; i < numPixels; ++i) {\n"
+               << "                coords.col(i) += shape.col(closestLandmarks[i]);\n"
+               << "            }\n"
+               << "            coords = shapeToImage.matrix() * coords.colwise().homogeneous();\n\n"
+               << "            dest::core::readImage(img, coords, intensities);\n"
+               << "        }\n\n";
+
+            for (flatbuffers::uoffset_t i = 0; i < cascade.size(); ++i) {
+                if (!writeRegressor(os, *cascade.Get(i), static_cast<int>(i), numLandmarks)) {
+                    return false;
+                }
+            }
+
+            os << "    }\n\n"
+               << "    dest::core::Shape " << opts.functionName << "(const dest::core::Image &img, const dest::core::ShapeTransform &shapeToImage) {\n"
+               << "        dest::core::Shape estimate = Eigen::Map<const dest::core::Shape>(meanShape, 3, numLandmarks);\n";
+            for (flatbuffers::uoffset_t i = 0; i < cascade.size(); ++i) {
+                os << "        c" << i << "_update(img, shapeToImage, estimate);\n";
+            }
+            os << "        return shapeToImage * estimate.colwise().homogeneous();\n"
+               << "    }\n"
+               << "}\n";
+
+            return !os.bad();
+        }
+    }
+}
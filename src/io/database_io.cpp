@@ -21,6 +21,9 @@
 #include <dest/io/rect_io.h>
 #include <opencv2/opencv.hpp>
 #include <fstream>
+#include <map>
+#include <algorithm>
+#include <stdint.h>
 
 namespace dest {
     namespace io {
@@ -28,6 +31,8 @@ namespace dest {
         ImportParameters::ImportParameters() {
             maxImageSideLength = std::numeric_limits<int>::max();
             generateVerticallyMirrored = false;
+            cropMargin = -1.f;
+            cropFaceSize = 0;
         }
 
         DatabaseType importDatabase(const std::string & directory,
@@ -36,12 +41,14 @@ namespace dest {
                                     std::vector<core::Shape>& shapes,
                                     std::vector<core::Rect>& rects,
                                     const ImportParameters & opts,
-                                    std::vector<float> *scaleFactors)
+                                    std::vector<float> *scaleFactors,
+                                    std::vector<int> *imageIds,
+                                    std::vector<bool> *mirrored)
         {
 			const bool isAFLW = util::findFilesInDir(directory, "mat", true, true).size() > 0;
 
             if (isAFLW) {
-				bool ok = importAFLWAnnotatedFaceDatabase(directory, rectangleFile, images, shapes, rects, opts, scaleFactors);
+				bool ok = importAFLWAnnotatedFaceDatabase(directory, rectangleFile, images, shapes, rects, opts, scaleFactors, imageIds, mirrored);
 				return ok ? DATABASE_AFLW : DATABASE_ERROR;
 			}
 			else{
@@ -67,35 +74,124 @@ namespace dest {
             r *= factor;
         }
 
-        cv::Mat loadImageFromFilePrefix(const std::string &prefix) {
-            const std::string extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ""};
-
-            cv::Mat img;
-            const std::string *ext = extensions;
-
-            do {
-                img = cv::imread(prefix + *ext, cv::IMREAD_GRAYSCALE);
-                ++ext;
-            } while (*ext != "" && img.empty());
+        void cropImageShapeAndRect(cv::Mat &img, core::Shape &s, core::Rect &r, const ImportParameters &p) {
+            const Eigen::Vector2f minC = r.rowwise().minCoeff();
+            const Eigen::Vector2f maxC = r.rowwise().maxCoeff();
+            const Eigen::Vector2f margin = (maxC - minC) * p.cropMargin;
+            
+            const int x0 = std::max<int>(0, static_cast<int>(std::floor(minC.x() - margin.x())));
+            const int y0 = std::max<int>(0, static_cast<int>(std::floor(minC.y() - margin.y())));
+            const int x1 = std::min<int>(img.cols, static_cast<int>(std::ceil(maxC.x() + margin.x())) + 1);
+            const int y1 = std::min<int>(img.rows, static_cast<int>(std::ceil(maxC.y() + margin.y())) + 1);
+            
+            if (x1 <= x0 || y1 <= y0) {
+                // Face outside of image, keep as is
+                return;
+            }
+            
+            // Clone to release the memory of the full image
+            img = img(cv::Rect(x0, y0, x1 - x0, y1 - y0)).clone();
+            
+            s.row(0).array() -= static_cast<float>(x0);
+            s.row(1).array() -= static_cast<float>(y0);
+            r.row(0).array() -= static_cast<float>(x0);
+            r.row(1).array() -= static_cast<float>(y0);
+            
+            const float faceSize = (maxC - minC).maxCoeff();
+            if (p.cropFaceSize > 0 && faceSize > 0.f) {
+                scaleImageShapeAndRect(img, s, r, static_cast<float>(p.cropFaceSize) / faceSize);
+            }
+        }
 
-            return img;
+        bool readFile(const std::string &path, std::vector<uchar> &bytes) {
+            std::ifstream file(path.c_str(), std::ios::binary);
+            if (!file.is_open()) {
+                return false;
+            }
+            
+            file.seekg(0, std::ios::end);
+            bytes.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0, std::ios::beg);
+            file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+            
+            return file.good() && !bytes.empty();
         }
         
-        void mirrorImageShapeAndRectVertically(cv::Mat &img,
-                                               core::Shape &s,
-                                               core::Rect &r,
-                                               const Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic> &permLandmarks,
-                                               const Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic> &permRectangle)
+        /** FNV-1a hash of encoded image files used to detect shared source images. */
+        uint64_t hashBytes(const std::vector<uchar> &bytes) {
+            uint64_t h = 14695981039346656037ULL;
+            for (size_t i = 0; i < bytes.size(); ++i) {
+                h = (h ^ bytes[i]) * 1099511628211ULL;
+            }
+            return h;
+        }
+        
+        /** Image already imported from a file with identical content. */
+        struct SharedImage {
+            std::string path;
+            int imageId;
+            float scale;
+        };
+        
+        /** State of a single database entry while passing through the import pipeline. */
+        struct ImportEntry {
+            std::string imagePath;
+            std::vector<uchar> bytes;
+            uint64_t hash;
+            core::Shape shape;
+            core::Rect rect;
+            
+            // Image of a previous block or entry of the current block with identical content
+            int sharedImageId;
+            int sharedEntry;
+            
+            cv::Mat image;
+            float scale;
+            int imageId;
+            bool ok;
+        };
+        
+        /**
+            Map each file prefix to an image file in the given list. When several images share a
+            prefix, extensions are preferred in the order given.
+        */
+        std::map<std::string, std::string> mapImageFilesByPrefix(const std::vector<std::string> &files, const std::vector<std::string> &extensions) {
+            std::map<std::string, std::string> prefixToFile;
+            std::map<std::string, size_t> prefixToRank;
+            
+            for (size_t i = 0; i < files.size(); ++i) {
+                const size_t dot = files[i].find_last_of(".");
+                if (dot == std::string::npos) {
+                    continue;
+                }
+                
+                const std::string prefix = files[i].substr(0, dot);
+                const size_t rank = std::find(extensions.begin(), extensions.end(), files[i].substr(dot + 1)) - extensions.begin();
+                
+                std::map<std::string, size_t>::iterator r = prefixToRank.find(prefix);
+                if (r == prefixToRank.end() || rank < r->second) {
+                    prefixToRank[prefix] = rank;
+                    prefixToFile[prefix] = files[i];
+                }
+            }
+            
+            return prefixToFile;
+        }
+        
+        void mirrorShapeAndRectVertically(int imageWidth,
+                                          core::Shape &s,
+                                          core::Rect &r,
+                                          const Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic> &permLandmarks,
+                                          const Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic> &permRectangle)
         {
-            cv::flip(img, img, 1);
             for (core::Shape::Index i = 0; i < s.cols(); ++i) {
-                s(0, i) = static_cast<float>(img.cols - 1) - s(0, i);
+                s(0, i) = static_cast<float>(imageWidth - 1) - s(0, i);
             }
             s = (s * permLandmarks).eval();
             
             
             for (core::Rect::Index i = 0; i < r.cols(); ++i) {
-                r(0, i) = static_cast<float>(img.cols - 1) - r(0, i);
+                r(0, i) = static_cast<float>(imageWidth - 1) - r(0, i);
             }
             
             r = (r * permRectangle).eval();
@@ -225,10 +321,34 @@ namespace dest {
 			std::vector<core::Shape> &shapes,
 			std::vector<core::Rect> &rects,
 			const ImportParameters &opts,
-			std::vector<float> *scaleFactors)
+			std::vector<float> *scaleFactors,
+			std::vector<int> *imageIds,
+			std::vector<bool> *mirrored)
 		{
 
-			std::vector<std::string> paths = util::findFilesInDir(directory, "mat", true, true);
+			// List database once instead of probing image extensions per entry.
+			std::vector<std::string> imageExtensions;
+			imageExtensions.push_back("png");
+			imageExtensions.push_back("jpg");
+			imageExtensions.push_back("jpeg");
+			imageExtensions.push_back("bmp");
+
+			std::vector<std::string> extensions = imageExtensions;
+			extensions.push_back("mat");
+
+			std::vector<std::string> files = util::findFilesInDir(directory, extensions, false, true);
+			std::vector<std::string> paths;
+			std::vector<std::string> imageFiles;
+			for (size_t i = 0; i < files.size(); ++i) {
+				const size_t dot = files[i].find_last_of(".");
+				if (files[i].compare(dot + 1, std::string::npos, "mat") == 0) {
+					paths.push_back(files[i].substr(0, dot));
+				} else {
+					imageFiles.push_back(files[i]);
+				}
+			}
+			const std::map<std::string, std::string> imageFileByPrefix = mapImageFilesByPrefix(imageFiles, imageExtensions);
+
 			DEST_LOG("Loading AFLW database. Found " << paths.size() << " candidate entries.");
 			//need to upgrade...
 			std::vector<core::Rect> loadedRects;
@@ -244,51 +364,193 @@ namespace dest {
 				}
 			}
 
-			size_t initialSize = images.size();
+			const size_t initialSize = shapes.size();
+			const bool virtualMirroring = imageIds && mirrored;
+
+			// Several entries may share a source image. Those are decoded once when shapes can
+			// refer to images by index and images are not cropped per face.
+			const bool shareImages = imageIds && opts.cropMargin < 0.f;
+			std::multimap<uint64_t, SharedImage> sharedImages;
+			int numShared = 0;
+
+			std::vector<uchar> otherBytes;
+
+			// Entries are processed in blocks. Reading and decoding runs in parallel, results
+			// are appended in database order, so the import does not depend on thread count.
+			const int numPaths = static_cast<int>(paths.size());
+			const int blockSize = 256;
+			std::vector<ImportEntry> entries(blockSize);
+
+			for (int b0 = 0; b0 < numPaths; b0 += blockSize) {
+				const int numEntries = std::min<int>(blockSize, numPaths - b0);
+
+				// Parse shapes and read encoded images
+#ifdef DEST_WITH_OPENMP
+				#pragma omp parallel for schedule(dynamic)
+#endif
+				for (int j = 0; j < numEntries; ++j) {
+					const int i = b0 + j;
+					ImportEntry &e = entries[j];
+					e.sharedImageId = -1;
+					e.sharedEntry = -1;
+					e.imageId = -1;
+					e.scale = 1.f;
+					e.image = cv::Mat();
+					e.bytes.clear();
+
+					bool ptsOk;
+					// MAT-file API is not thread-safe
+#ifdef DEST_WITH_OPENMP
+					#pragma omp critical(dest_parse_mat)
+#endif
+					{
+						ptsOk = parseMatFile(paths[i] + ".mat", e.shape);
+					}
+
+					std::map<std::string, std::string>::const_iterator imageFile = imageFileByPrefix.find(paths[i]);
+					const bool imgOk = imageFile != imageFileByPrefix.end() && readFile(imageFile->second, e.bytes);
+					const bool validRect = loadedRects.empty() || !loadedRects[i].isZero();
+
+					e.ok = ptsOk && imgOk && validRect;
+					if (!e.ok) {
+						continue;
+					}
 
-			for (size_t i = 0; i < paths.size(); ++i) {
-				const std::string fileNameMat = paths[i] + ".mat";
+					e.imagePath = imageFile->second;
+					e.rect = loadedRects.empty() ? core::shapeBounds(e.shape) : loadedRects[i];
+					e.hash = shareImages ? hashBytes(e.bytes) : 0;
+				}
 
-				core::Shape s;
-				core::Rect r;
-				bool ptsOk = parseMatFile(fileNameMat, s);
-				cv::Mat cvImg = loadImageFromFilePrefix(paths[i]);
-				const bool validRect = loadedRects.empty() || !loadedRects[i].isZero();
+				// Find images with identical content in previous blocks and the current block
+				if (shareImages) {
+					for (int j = 0; j < numEntries; ++j) {
+						ImportEntry &e = entries[j];
+						if (!e.ok) {
+							continue;
+						}
 
-				if (ptsOk && !cvImg.empty() && validRect) {
+						typedef std::multimap<uint64_t, SharedImage>::const_iterator Iter;
+						std::pair<Iter, Iter> candidates = sharedImages.equal_range(e.hash);
+						for (Iter c = candidates.first; c != candidates.second && e.sharedImageId < 0; ++c) {
+							if (readFile(c->second.path, otherBytes) && otherBytes == e.bytes) {
+								e.sharedImageId = c->second.imageId;
+								e.scale = c->second.scale;
+							}
+						}
 
-					if (loadedRects.empty()) {
-						r = core::shapeBounds(s);
+						for (int k = 0; k < j && e.sharedImageId < 0 && e.sharedEntry < 0; ++k) {
+							const ImportEntry &o = entries[k];
+							if (o.ok && o.sharedImageId < 0 && o.sharedEntry < 0 && o.hash == e.hash && o.bytes == e.bytes) {
+								e.sharedEntry = k;
+							}
+						}
 					}
-					else {
-						r = loadedRects[i];
+				}
+
+				// Decode, rescale and crop unique images
+#ifdef DEST_WITH_OPENMP
+				#pragma omp parallel for schedule(dynamic)
+#endif
+				for (int j = 0; j < numEntries; ++j) {
+					ImportEntry &e = entries[j];
+					if (!e.ok || e.sharedImageId >= 0 || e.sharedEntry >= 0) {
+						continue;
+					}
+
+					e.image = cv::imdecode(e.bytes, cv::IMREAD_GRAYSCALE);
+					if (e.image.empty()) {
+						e.ok = false;
+						continue;
 					}
 
-					float f;
-					if (imageNeedsScaling(cvImg.size(), opts, f)) {
-						scaleImageShapeAndRect(cvImg, s, r, f);
+					if (imageNeedsScaling(e.image.size(), opts, e.scale)) {
+						scaleImageShapeAndRect(e.image, e.shape, e.rect, e.scale);
 					}
 
-					core::Image img;
-					util::toDest(cvImg, img);
+					if (opts.cropMargin >= 0.f) {
+						cropImageShapeAndRect(e.image, e.shape, e.rect, opts);
+					}
+				}
+
+				// Append results in database order
+				for (int j = 0; j < numEntries; ++j) {
+					ImportEntry &e = entries[j];
+
+					if (e.sharedEntry >= 0) {
+						const ImportEntry &o = entries[e.sharedEntry];
+						e.ok = o.ok;
+						e.sharedImageId = o.imageId;
+						e.scale = o.scale;
+					}
+
+					if (!e.ok) {
+						continue;
+					}
+
+					core::Shape &s = e.shape;
+					core::Rect &r = e.rect;
+					const float f = e.scale;
+
+					if (e.sharedImageId >= 0) {
+						s *= f;
+						r *= f;
+						e.imageId = e.sharedImageId;
+						++numShared;
+					} else {
+						core::Image img;
+						util::toDest(e.image, img);
+						e.image.release();
+
+						e.imageId = static_cast<int>(images.size());
+						images.push_back(img);
+
+						if (shareImages) {
+							SharedImage si = { e.imagePath, e.imageId, f };
+							sharedImages.insert(std::make_pair(e.hash, si));
+						}
+					}
+
+					const int imageId = e.imageId;
 
-					images.push_back(img);
 					shapes.push_back(s);
 					rects.push_back(r);
 
 					if (scaleFactors) {
 						scaleFactors->push_back(f);
 					}
+					if (imageIds) {
+						imageIds->push_back(imageId);
+					}
+					if (mirrored) {
+						mirrored->push_back(false);
+					}
 
 
 					if (opts.generateVerticallyMirrored) {
-						cv::Mat cvFlipped = cvImg.clone();
-						mirrorImageShapeAndRectVertically(cvFlipped, s, r, permutationMatrixForMirroredIBug(), permutationMatrixForMirroredRectangle());
-
-						core::Image imgFlipped;
-						util::toDest(cvFlipped, imgFlipped);
+						const int imageWidth = static_cast<int>(images[imageId].cols());
+						mirrorShapeAndRectVertically(imageWidth, s, r, permutationMatrixForMirroredIBug(), permutationMatrixForMirroredRectangle());
+
+						if (virtualMirroring) {
+							// Shape refers to the original image
+							imageIds->push_back(imageId);
+							mirrored->push_back(true);
+						} else {
+							cv::Mat cvImg, cvFlipped;
+							util::toCVHeaderOnly(images[imageId], cvImg);
+							cv::flip(cvImg, cvFlipped, 1);
+
+							core::Image imgFlipped;
+							util::toDest(cvFlipped, imgFlipped);
+
+							if (imageIds) {
+								imageIds->push_back(static_cast<int>(images.size()));
+							}
+							if (mirrored) {
+								mirrored->push_back(false);
+							}
+							images.push_back(imgFlipped);
+						}
 
-						images.push_back(imgFlipped);
 						shapes.push_back(s);
 						rects.push_back(r);
 
@@ -299,6 +561,10 @@ namespace dest {
 				}
 			}
 
+			if (numShared > 0) {
+				DEST_LOG("Shared " << numShared << " source images between entries.");
+			}
+
 			DEST_LOG("Successfully loaded " << (shapes.size() - initialSize) << " entries from database.");
 			return (shapes.size() - initialSize) > 0;
 
@@ -11,11 +11,17 @@
 #include <dest/util/glob.h>
 #include <tinydir/tinydir.h>
 #include <stack>
+#include <algorithm>
 
 namespace dest {
     namespace util {
         
         std::vector<std::string> findFilesInDir(const std::string &directory, const std::string &extension, bool stripExtension, bool recursive)
+        {
+            return findFilesInDir(directory, std::vector<std::string>(1, extension), stripExtension, recursive);
+        }
+        
+        std::vector<std::string> findFilesInDir(const std::string &directory, const std::vector<std::string> &extensions, bool stripExtension, bool recursive)
         {
             std::vector<std::string> files;
             
@@ -44,7 +50,7 @@ namespace dest {
                         continue;
                     }
 
-                    if (extension != file.extension) {
+                    if (std::find(extensions.begin(), extensions.end(), std::string(file.extension)) == extensions.end()) {
                         continue;
                     }
 
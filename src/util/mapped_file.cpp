@@ -0,0 +1,152 @@
+/**
+    This file is part of Deformable Shape Tracking (DEST).
+
+    Copyright(C) 2015/2016 Christoph Heindl
+    All rights reserved.
+
+    This software may be modified and distributed under the terms
+    of the BSD license.See the LICENSE file for details.
+*/
+
+#include <dest/util/mapped_file.h>
+#include <dest/util/log.h>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+namespace dest {
+    namespace util {
+        
+        struct MappedFile::data {
+            void *ptr;
+            size_t size;
+#ifdef _WIN32
+            HANDLE file;
+            HANDLE mapping;
+#endif
+            
+            data()
+            : ptr(0), size(0)
+#ifdef _WIN32
+            , file(INVALID_HANDLE_VALUE), mapping(0)
+#endif
+            {}
+        };
+        
+        MappedFile::MappedFile()
+        : _data(new data())
+        {}
+        
+        MappedFile::~MappedFile()
+        {
+            close();
+        }
+        
+        bool MappedFile::create(const std::string &directory, size_t size)
+        {
+            close();
+            
+            if (size == 0) {
+                return true;
+            }
+            
+            data &d = *_data;
+            
+#ifdef _WIN32
+            char path[MAX_PATH];
+            if (GetTempFileNameA(directory.c_str(), "dst", 0, path) == 0) {
+                DEST_LOG("Failed to create temporary file in " << directory << std::endl);
+                return false;
+            }
+            
+            d.file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, 0);
+            if (d.file == INVALID_HANDLE_VALUE) {
+                DEST_LOG("Failed to open temporary file " << path << std::endl);
+                DeleteFileA(path);
+                return false;
+            }
+            
+            const unsigned long long size64 = static_cast<unsigned long long>(size);
+            d.mapping = CreateFileMappingA(d.file, 0, PAGE_READWRITE, static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64 & 0xFFFFFFFF), 0);
+            if (d.mapping) {
+                d.ptr = MapViewOfFile(d.mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+            }
+#else
+            std::string pattern = directory + "/dest_XXXXXX";
+            std::vector<char> path(pattern.begin(), pattern.end());
+            path.push_back('\0');
+            
+            int fd = mkstemp(&path[0]);
+            if (fd < 0) {
+                DEST_LOG("Failed to create temporary file in " << directory << std::endl);
+                return false;
+            }
+            
+            // File stays accessible through the mapping only
+            unlink(&path[0]);
+            
+            if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+                void *ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (ptr != MAP_FAILED) {
+                    d.ptr = ptr;
+                }
+            }
+            ::close(fd);
+#endif
+            
+            if (!d.ptr) {
+                DEST_LOG("Failed to map temporary file of " << size << " bytes." << std::endl);
+                close();
+                return false;
+            }
+            
+            d.size = size;
+            return true;
+        }
+        
+        void MappedFile::close()
+        {
+            data &d = *_data;
+            
+#ifdef _WIN32
+            if (d.ptr) {
+                UnmapViewOfFile(d.ptr);
+            }
+            if (d.mapping) {
+                CloseHandle(d.mapping);
+            }
+            if (d.file != INVALID_HANDLE_VALUE) {
+                CloseHandle(d.file);
+            }
+            d.mapping = 0;
+            d.file = INVALID_HANDLE_VALUE;
+#else
+            if (d.ptr) {
+                munmap(d.ptr, d.size);
+            }
+#endif
+            d.ptr = 0;
+            d.size = 0;
+        }
+        
+        void *MappedFile::memory() const
+        {
+            return _data->ptr;
+        }
+        
+        size_t MappedFile::size() const
+        {
+            return _data->size;
+        }
+        
+    }
+}
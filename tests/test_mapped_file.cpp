@@ -0,0 +1,80 @@
+/**
+    This file is part of Deformable Shape Tracking (DEST).
+
+    Copyright(C) 2015/2016 Christoph Heindl
+    All rights reserved.
+
+    This software may be modified and distributed under the terms
+    of the BSD license.See the LICENSE file for details.
+*/
+
+#include "catch.hpp"
+
+#include <dest/util/mapped_file.h>
+#include <dest/core/training_data.h>
+
+TEST_CASE("mapped-file")
+{
+    dest::util::MappedFile f;
+    REQUIRE(f.memory() == 0);
+    REQUIRE(f.size() == 0);
+
+    const int count = 10000;
+    REQUIRE(f.create(".", count * sizeof(int)));
+    REQUIRE(f.memory() != 0);
+    REQUIRE(f.size() == count * sizeof(int));
+
+    int *values = static_cast<int*>(f.memory());
+    for (int i = 0; i < count; ++i) {
+        values[i] = i * 7;
+    }
+
+    const int *readback = static_cast<const int*>(f.memory());
+    bool same = true;
+    for (int i = 0; i < count; ++i) {
+        same = same && (readback[i] == i * 7);
+    }
+    REQUIRE(same);
+
+    f.close();
+    REQUIRE(f.memory() == 0);
+    REQUIRE(f.size() == 0);
+
+    REQUIRE(!f.create("./directory-that-does-not-exist", 16));
+    REQUIRE(f.memory() == 0);
+}
+
+TEST_CASE("sample-storage")
+{
+    const char *directories[] = {"", "."};
+
+    for (int d = 0; d < 2; ++d) {
+        dest::core::SampleStorage storage;
+        dest::core::SampleMatrixMap m(0, 0, 0);
+
+        storage.allocate(m, 50, 3, directories[d]);
+        REQUIRE(m.rows() == 50);
+        REQUIRE(m.cols() == 3);
+        REQUIRE((d == 0) == (storage.file.memory() == 0));
+
+        dest::core::SampleMatrix expected = dest::core::SampleMatrix::Random(50, 3);
+        m = expected;
+        REQUIRE(dest::core::SampleMatrix(m) == expected);
+
+        // Reallocating binds the view to fresh storage
+        storage.allocate(m, 4, 2, directories[d]);
+        REQUIRE(m.rows() == 4);
+        REQUIRE(m.cols() == 2);
+        m.setConstant(1.f);
+        REQUIRE(m.sum() == 8.f);
+
+        // Column-major views share the same storage
+        Eigen::Map<Eigen::MatrixXf> c(0, 0, 0);
+        storage.allocate(c, 6, 20, directories[d]);
+        REQUIRE(c.rows() == 6);
+        REQUIRE(c.cols() == 20);
+        c.setZero();
+        c.col(19).setConstant(2.f);
+        REQUIRE(c.sum() == 12.f);
+    }
+}
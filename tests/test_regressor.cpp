@@ -0,0 +1,105 @@
+/**
+    This file is part of Deformable Shape Tracking (DEST).
+
+    Copyright(C) 2015/2016 Christoph Heindl
+    All rights reserved.
+
+    This software may be modified and distributed under the terms
+    of the BSD license.See the LICENSE file for details.
+*/
+
+#include "catch.hpp"
+
+#include <dest/core/regressor.h>
+#include <dest/io/matrix_io.h>
+#include <random>
+
+TEST_CASE("regressor-residual-basis")
+{
+    dest::core::Image img(16, 16);
+    for (int y = 0; y < 16; ++y) {
+        for (int x = 0; x < 16; ++x) {
+            img(y, x) = static_cast<unsigned char>(10 * x + y);
+        }
+    }
+
+    dest::core::Shape meanShape(3, 2);
+    meanShape << 5.f, 10.f,
+                 5.f, 9.f,
+                 0.f, 0.f;
+
+    dest::core::PixelCoordinates coords(3, 2);
+    coords << 0.f, 1.f,
+              0.f, 2.f,
+              0.f, 0.f;
+
+    Eigen::VectorXi closest(2);
+    closest << 0, 1;
+
+    dest::core::ShapeResidual meanResidual(3, 2);
+    meanResidual << 0.1f, -0.2f,
+                    0.3f, 0.4f,
+                    0.f, 0.f;
+
+    std::mt19937 rnd(3);
+    std::uniform_real_distribution<float> dr(-1.f, 1.f);
+
+    Eigen::MatrixXf basis(6, 2);
+    Eigen::MatrixXf leaves(2, 4);
+    for (int i = 0; i < basis.size(); ++i) {
+        basis(i) = dr(rnd);
+    }
+    for (int i = 0; i < leaves.size(); ++i) {
+        leaves(i) = dr(rnd);
+    }
+
+    // First tree always takes its left leaf, second tree its right leaf.
+    const float thresholds[] = {-1000.f, 1000.f};
+    const float learningRate = 0.1f;
+
+    flatbuffers::FlatBufferBuilder fbb;
+    std::vector< flatbuffers::Offset<dest::io::Tree> > ltrees;
+    for (int t = 0; t < 2; ++t) {
+        std::vector< flatbuffers::Offset<dest::io::TreeNode> > lnodes;
+        lnodes.push_back(dest::io::CreateTreeNode(fbb, 0, 1, thresholds[t]));
+        for (int l = 0; l < 2; ++l) {
+            Eigen::VectorXf mean = leaves.col(2 * t + l);
+            lnodes.push_back(dest::io::CreateTreeNode(fbb, -1, -1, 0.f, dest::io::toFbs(fbb, mean)));
+        }
+        ltrees.push_back(dest::io::CreateTree(fbb, fbb.CreateVector(lnodes), 2));
+    }
+
+    flatbuffers::Offset<dest::io::MatrixF> lcoords = dest::io::toFbs(fbb, coords);
+    flatbuffers::Offset<dest::io::MatrixI> lclosest = dest::io::toFbs(fbb, closest);
+    flatbuffers::Offset<dest::io::MatrixF> lmeanr = dest::io::toFbs(fbb, meanResidual);
+    flatbuffers::Offset<dest::io::MatrixF> lmeans = dest::io::toFbs(fbb, meanShape);
+    flatbuffers::Offset<dest::io::MatrixF> lbasis = dest::io::toFbs(fbb, basis);
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<dest::io::Tree> > > vtrees = fbb.CreateVector(ltrees);
+
+    dest::io::RegressorBuilder b(fbb);
+    b.add_pixelCoordinates(lcoords);
+    b.add_closestLandmarks(lclosest);
+    b.add_meanShapeResidual(lmeanr);
+    b.add_meanShape(lmeans);
+    b.add_forest(vtrees);
+    b.add_learningRate(learningRate);
+    b.add_residualBasis(lbasis);
+    fbb.Finish(b.Finish());
+
+    dest::core::Regressor r;
+    r.load(*flatbuffers::GetRoot<dest::io::Regressor>(fbb.GetBufferPointer()));
+
+    // Reconstruct each tree's leaf coefficients separately.
+    Eigen::VectorXf expectedFlat = Eigen::Map<const Eigen::VectorXf>(meanResidual.data(), 6);
+    expectedFlat += learningRate * (basis * leaves.col(0));
+    expectedFlat += learningRate * (basis * leaves.col(3));
+    const dest::core::ShapeResidual expected = Eigen::Map<const dest::core::ShapeResidual>(expectedFlat.data(), 3, 2);
+
+    const dest::core::ShapeTransform shapeToImage = dest::core::ShapeTransform::Identity();
+    REQUIRE(r.predict(img, meanShape, shapeToImage).isApprox(expected));
+
+    // Quantized coefficients resolve through the codebook first, then the basis.
+    std::mt19937 qrnd(5);
+    r.quantizeLeaves(4, qrnd);
+    REQUIRE(r.predict(img, meanShape, shapeToImage).isApprox(expected));
+}
@@ -51,4 +51,26 @@ TEST_CASE("shape-bounds")
 	dest::core::Rect expected = dest::core::createRectangle(Eigen::Vector2f(0.f, 0.f), Eigen::Vector2f(2.f, 2.f));
 
     REQUIRE(r.isApprox(expected));
-}
\ No newline at end of file
+}
+
+TEST_CASE("landmark-index")
+{
+    dest::core::Shape s = dest::core::Shape::Random(3, 194);
+    s.col(10) = s.col(20); // duplicate landmark, lower index wins
+
+    dest::core::PixelCoordinates x = dest::core::PixelCoordinates::Random(3, 500);
+    x.col(0) = s.col(20);
+
+    dest::core::LandmarkIndex index(s);
+
+    Eigen::VectorXi closest;
+    index.closestLandmarks(x, closest);
+
+    REQUIRE(closest(0) == 10);
+
+    for (int i = 0; i < x.cols(); ++i) {
+        int expected;
+        (s.colwise() - x.col(i)).colwise().squaredNorm().minCoeff(&expected);
+        REQUIRE(closest(i) == expected);
+    }
+}
@@ -0,0 +1,120 @@
+/**
+    This file is part of Deformable Shape Tracking (DEST).
+
+    Copyright(C) 2015/2016 Christoph Heindl
+    All rights reserved.
+
+    This software may be modified and distributed under the terms
+    of the BSD license.See the LICENSE file for details.
+*/
+
+#include "catch.hpp"
+
+#include <dest/core/tracker.h>
+#include <dest/io/matrix_io.h>
+#include <random>
+#include <string>
+
+/**
+    Build a tracker of two cascades with three depth-2 trees each. Leaf residuals are random.
+*/
+static void buildTracker(flatbuffers::FlatBufferBuilder &fbb, const dest::core::Shape &meanShape)
+{
+    std::mt19937 rnd(7);
+    std::uniform_real_distribution<float> dr(-1.f, 1.f);
+
+    dest::core::PixelCoordinates coords(3, 3);
+    coords << 0.f, 1.f, -2.f,
+              0.f, 2.f, 1.f,
+              0.f, 0.f, 0.f;
+
+    Eigen::VectorXi closest(3);
+    closest << 0, 1, 0;
+
+    std::vector< flatbuffers::Offset<dest::io::Regressor> > lregs;
+    for (int c = 0; c < 2; ++c) {
+        std::vector< flatbuffers::Offset<dest::io::Tree> > ltrees;
+        for (int i = 0; i < 3; ++i) {
+            std::vector< flatbuffers::Offset<dest::io::TreeNode> > lnodes;
+            lnodes.push_back(dest::io::CreateTreeNode(fbb, i % 3, (i + 1) % 3, 5.f * (i - 1)));
+            for (int l = 0; l < 2; ++l) {
+                Eigen::VectorXf mean(6);
+                for (int k = 0; k < 6; ++k) {
+                    mean(k) = dr(rnd);
+                }
+                lnodes.push_back(dest::io::CreateTreeNode(fbb, -1, -1, 0.f, dest::io::toFbs(fbb, mean)));
+            }
+            ltrees.push_back(dest::io::CreateTree(fbb, fbb.CreateVector(lnodes), 2));
+        }
+
+        flatbuffers::Offset<dest::io::MatrixF> lcoords = dest::io::toFbs(fbb, coords);
+        flatbuffers::Offset<dest::io::MatrixI> lclosest = dest::io::toFbs(fbb, closest);
+        flatbuffers::Offset<dest::io::MatrixF> lmeanr = dest::io::toFbs(fbb, dest::core::ShapeResidual(dest::core::ShapeResidual::Zero(3, 2)));
+        flatbuffers::Offset<dest::io::MatrixF> lmeans = dest::io::toFbs(fbb, meanShape);
+        flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<dest::io::Tree> > > vtrees = fbb.CreateVector(ltrees);
+
+        dest::io::RegressorBuilder b(fbb);
+        b.add_pixelCoordinates(lcoords);
+        b.add_closestLandmarks(lclosest);
+        b.add_meanShapeResidual(lmeanr);
+        b.add_meanShape(lmeans);
+        b.add_forest(vtrees);
+        b.add_learningRate(0.5f);
+        lregs.push_back(b.Finish());
+    }
+
+    flatbuffers::Offset<dest::io::MatrixF> lmeans = dest::io::toFbs(fbb, meanShape);
+    flatbuffers::Offset<dest::io::MatrixF> lbounds = dest::io::toFbs(fbb, meanShape);
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<dest::io::Regressor> > > vregs = fbb.CreateVector(lregs);
+    dest::io::FinishTrackerBuffer(fbb, dest::io::CreateTracker(fbb, lmeans, lbounds, vregs));
+}
+
+static std::string saveToString(const dest::core::Tracker &t)
+{
+    flatbuffers::FlatBufferBuilder fbb;
+    dest::io::FinishTrackerBuffer(fbb, t.save(fbb));
+    return std::string(reinterpret_cast<const char*>(fbb.GetBufferPointer()), fbb.GetSize());
+}
+
+TEST_CASE("tracker-quantized-leaves-roundtrip")
+{
+    dest::core::Image img(16, 16);
+    for (int y = 0; y < 16; ++y) {
+        for (int x = 0; x < 16; ++x) {
+            img(y, x) = static_cast<unsigned char>(10 * x + y);
+        }
+    }
+
+    dest::core::Shape meanShape(3, 2);
+    meanShape << 5.f, 10.f,
+                 5.f, 9.f,
+                 0.f, 0.f;
+
+    dest::core::ShapeTransform shapeToImage = dest::core::ShapeTransform::Identity();
+
+    flatbuffers::FlatBufferBuilder fbb;
+    buildTracker(fbb, meanShape);
+
+    dest::core::Tracker t;
+    t.load(*dest::io::GetTracker(fbb.GetBufferPointer()));
+    const dest::core::Shape unquantized = t.predict(img, shapeToImage);
+
+    // One codebook entry per leaf reproduces leaf residuals
+    std::mt19937 rnd(10);
+    dest::core::Tracker exact(t);
+    exact.quantizeLeaves(6, rnd);
+    REQUIRE(exact.predict(img, shapeToImage).isApprox(unquantized));
+
+    // Codebook and leaf codes survive save and load
+    dest::core::Tracker quantized(t);
+    quantized.quantizeLeaves(2, rnd);
+    const dest::core::Shape expected = quantized.predict(img, shapeToImage);
+
+    const std::string saved = saveToString(quantized);
+    dest::core::Tracker loaded;
+    loaded.load(*dest::io::GetTracker(saved.data()));
+
+    REQUIRE(loaded.predict(img, shapeToImage) == expected);
+    REQUIRE(saveToString(loaded) == saved);
+    REQUIRE(saveToString(loaded) != saveToString(t));
+}
@@ -0,0 +1,101 @@
+/**
+    This file is part of Deformable Shape Tracking (DEST).
+
+    Copyright(C) 2015/2016 Christoph Heindl
+    All rights reserved.
+
+    This software may be modified and distributed under the terms
+    of the BSD license.See the LICENSE file for details.
+*/
+
+#include "catch.hpp"
+
+#include <dest/core/training_data.h>
+#include <cmath>
+
+TEST_CASE("pixel-pair-distribution")
+{
+    dest::core::PixelCoordinates coords(3, 5);
+    coords << 0.f, 0.1f, 0.3f, 0.f, 0.5f,
+              0.f, 0.f, 0.2f, 0.4f, 0.5f,
+              0.f, 0.f, 0.f, 0.f, 0.f;
+
+    const float lambda = 0.1f;
+
+    dest::core::PixelPairDistribution dist;
+    dist.create(coords, lambda);
+
+    Eigen::MatrixXd expected = Eigen::MatrixXd::Zero(5, 5);
+    for (int i = 0; i < 5; ++i) {
+        for (int j = 0; j < 5; ++j) {
+            if (i != j) {
+                expected(i, j) = std::exp(-(coords.col(i) - coords.col(j)).norm() / lambda);
+            }
+        }
+    }
+    expected /= expected.sum();
+
+    std::mt19937 rnd(42);
+    const int numDraws = 1000000;
+    Eigen::MatrixXd observed = Eigen::MatrixXd::Zero(5, 5);
+    int idx1, idx2;
+    for (int k = 0; k < numDraws; ++k) {
+        dist.sample(rnd, idx1, idx2);
+        observed(idx1, idx2) += 1.0;
+    }
+    observed /= numDraws;
+
+    REQUIRE(observed.diagonal().isZero());
+    REQUIRE((observed - expected).cwiseAbs().maxCoeff() < 0.002);
+}
+
+TEST_CASE("pixel-pair-distribution-subset")
+{
+    dest::core::PixelCoordinates coords(3, 5);
+    coords << 0.f, 0.1f, 0.3f, 0.f, 0.5f,
+              0.f, 0.f, 0.2f, 0.4f, 0.5f,
+              0.f, 0.f, 0.f, 0.f, 0.f;
+
+    const float lambda = 0.1f;
+
+    std::vector<int> subset;
+    subset.push_back(0);
+    subset.push_back(2);
+    subset.push_back(4);
+
+    dest::core::PixelPairDistribution dist;
+    dist.create(coords, lambda);
+    dist.setSubset(subset);
+
+    // Pairs of the subset keep their relative probabilities
+    Eigen::MatrixXd expected = Eigen::MatrixXd::Zero(3, 3);
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            if (i != j) {
+                expected(i, j) = std::exp(-(coords.col(subset[i]) - coords.col(subset[j])).norm() / lambda);
+            }
+        }
+    }
+    expected /= expected.sum();
+
+    std::mt19937 rnd(42);
+    const int numDraws = 1000000;
+    Eigen::MatrixXd observed = Eigen::MatrixXd::Zero(3, 3);
+    int idx1, idx2;
+    bool inSubset = true;
+    for (int k = 0; k < numDraws && inSubset; ++k) {
+        inSubset = dist.sample(rnd, idx1, idx2) && idx1 >= 0 && idx1 < 3 && idx2 >= 0 && idx2 < 3;
+        if (inSubset) {
+            observed(idx1, idx2) += 1.0;
+        }
+    }
+    observed /= numDraws;
+
+    REQUIRE(inSubset);
+    REQUIRE(observed.diagonal().isZero());
+    REQUIRE((observed - expected).cwiseAbs().maxCoeff() < 0.002);
+
+    std::vector<int> single(1, 3);
+    dist.setSubset(single);
+    REQUIRE(!dist.sample(rnd, idx1, idx2));
+}
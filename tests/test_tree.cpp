@@ -0,0 +1,55 @@
+/**
+    This file is part of Deformable Shape Tracking (DEST).
+
+    Copyright(C) 2015/2016 Christoph Heindl
+    All rights reserved.
+
+    This software may be modified and distributed under the terms
+    of the BSD license.See the LICENSE file for details.
+*/
+
+#include "catch.hpp"
+
+#include <dest/core/tree.h>
+#include <cmath>
+#include <limits>
+
+TEST_CASE("split-histogram-bins")
+{
+    const int binCounts[] = { 2, 3, 7, 48, 64, 100, 255 };
+    const float inf = std::numeric_limits<float>::infinity();
+
+    for (int b = 0; b < 7; ++b) {
+        const int numBins = binCounts[b];
+
+        // Integer and fractional differences around each boundary
+        std::vector<float> diffs;
+        for (int k = 0; k <= numBins; ++k) {
+            const float t = dest::core::splitHistogramBoundary(k, numBins);
+            const float offsets[] = { -1.f, -0.5f, -0.25f, 0.f, 0.25f, 0.5f, 1.f };
+            for (int o = 0; o < 7; ++o) {
+                diffs.push_back(t + offsets[o]);
+            }
+            diffs.push_back(std::nextafter(t, -inf));
+            diffs.push_back(std::nextafter(t, inf));
+            diffs.push_back(std::floor(t));
+            diffs.push_back(std::ceil(t));
+        }
+        for (int d = -300; d <= 300; ++d) {
+            diffs.push_back(static_cast<float>(d));
+        }
+
+        for (size_t i = 0; i < diffs.size(); ++i) {
+            const int bin = dest::core::splitHistogramBin(diffs[i], numBins);
+            REQUIRE(bin >= 0);
+            REQUIRE(bin < numBins);
+
+            for (int k = 1; k < numBins; ++k) {
+                const float threshold = dest::core::splitHistogramBoundary(k, numBins);
+                if ((diffs[i] > threshold) != (bin >= k)) {
+                    FAIL("bins " << numBins << " difference " << diffs[i] << " bin " << bin << " boundary " << k);
+                }
+            }
+        }
+    }
+}